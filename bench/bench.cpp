@@ -0,0 +1,547 @@
+// Benchmarks for the engine, the MLP and end-to-end training.
+//
+// Prints one JSON object per case to stdout (progress goes to stderr), so
+// results can be diffed between commits:
+//
+//   bench [--filter substr] [--max-nodes n] [--reps n] [--compile] > results.json
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <functional>
+#include <iostream>
+#include <numeric>
+#include <random>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <sys/resource.h>
+
+#include "engine.h"
+#include "expr.h"
+#include "nn.h"
+#include "gen.h"
+#include "trace.h"
+#include "optim.h"
+#include "parallel.h"
+
+
+namespace {
+
+using micrograd::Value;
+using micrograd::ValuePtr;
+
+
+struct Options {
+    std::string filter{};
+    std::size_t max_nodes = 1'000'000;
+    std::size_t reps = 3;
+    bool compile = false;  // also run the cases that need a C compiler
+};
+
+struct Result {
+    double min_s;
+    double mean_s;
+    long peak_rss_growth_kb;
+};
+
+// Peak resident set size of the process so far. It never decreases, so
+// cases only report how far they raised it (see measure()).
+auto peak_rss_kb() -> long {
+    auto usage = rusage{};
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+// Time body() over reps runs, setup() runs untimed before each of them.
+// Also records how much the runs raised the process's peak RSS: 0 if a case
+// stayed below the peak of an earlier, larger one, so this is a lower bound
+// on the memory of the case, not its footprint.
+auto measure(std::size_t reps, const std::function<void()>& setup, const std::function<void()>& body) -> Result {
+    double min_s = 1e300;
+    double total_s = 0.0;
+    auto baseline_kb = peak_rss_kb();
+
+    for (std::size_t r = 0; r < reps; ++r) {
+        setup();
+
+        auto t0 = std::chrono::steady_clock::now();
+        body();
+        auto t1 = std::chrono::steady_clock::now();
+
+        auto s = std::chrono::duration<double>(t1 - t0).count();
+        min_s = std::min(min_s, s);
+        total_s += s;
+    }
+
+    return { min_s, total_s / static_cast<double>(reps), peak_rss_kb() - baseline_kb };
+}
+
+class Report {
+public:
+    explicit Report(const Options& options): options_{ options }, first_{ true } {}
+
+    auto wants(std::string_view name) const -> bool {
+        return options_.filter.empty() || name.find(options_.filter) != std::string_view::npos;
+    }
+
+    // items: nodes (engine cases), samples or steps (MLP and training cases)
+    auto add(const std::string& name, const std::string& params, std::size_t items, const char* unit, Result r) -> void {
+        auto per_s = static_cast<double>(items) / r.min_s;
+
+        std::cout << (first_ ? "[\n" : ",\n") << std::format(
+            R"(  {{"name": "{}", "params": {{{}}}, "time_s": {:.6g}, "mean_time_s": {:.6g}, "{}": {}, "{}_per_s": {:.6g}, "peak_rss_growth_kb": {}}})",
+            name, params, r.min_s, r.mean_s, unit, items, unit, per_s, r.peak_rss_growth_kb
+        );
+        first_ = false;
+
+        std::cerr << std::format("{:<28} {:<40} {:>10.3f} ms {:>12.4g} {}/s\n", name, params, r.min_s * 1e3, per_s, unit);
+    }
+
+    auto finish() -> void {
+        std::cout << (first_ ? "[]\n" : "\n]\n");
+    }
+
+private:
+    const Options& options_;
+    bool first_;
+};
+
+
+auto sizes_up_to(std::size_t max) -> std::vector<std::size_t> {
+    auto sizes = std::vector<std::size_t>{};
+    for (std::size_t n = 1'000; n <= max; n *= 10) sizes.push_back(n);
+    return sizes;
+}
+
+
+//
+// Engine
+//
+
+auto bench_ops(Report& report, const Options& options) -> void {
+    constexpr std::size_t n = 100'000;
+
+    auto a = std::make_shared<Value>(0.5);
+    auto b = std::make_shared<Value>(1.5);
+    auto operands = std::vector<ValuePtr>(16, a);
+
+    using MakeFn = std::function<ValuePtr()>;
+    auto ops = std::vector<std::pair<std::string, MakeFn>>{
+        { "add",        [&]() { return a + b; } },
+        { "add_const",  [&]() { return a + 1.0; } },
+        { "sub",        [&]() { return a - b; } },
+        { "neg",        [&]() { return -a; } },
+        { "mul",        [&]() { return a * b; } },
+        { "mul_const",  [&]() { return a * 2.0; } },
+        { "div",        [&]() { return a / b; } },
+        { "rdiv_const", [&]() { return 2.0 / a; } },
+        { "pow_const",  [&]() { return pow(a, 3.0); } },
+        { "exp",        [&]() { return exp(a); } },
+        { "tanh",       [&]() { return tanh(a); } },
+        { "relu",       [&]() { return relu(a); } },
+        { "dot16",      [&]() { return dot(operands, operands); } },
+        { "sum16",      [&]() { return sum(operands); } },
+        // One hinge loss term, as three nodes and as one fused node
+        { "hinge",       [&]() { return relu(1.0 - 2.0 * a); } },
+        { "hinge_fused", [&]() { return micrograd::fuse(micrograd::expr::relu(1.0 - 2.0 * micrograd::expr::arg), a); } },
+    };
+
+    auto nodes = std::vector<ValuePtr>(n);
+    auto arena = micrograd::GraphArena{};
+
+    for (const auto& [op, make]: ops) {
+        auto name = "op/" + op;
+        if (!report.wants(name)) continue;
+
+        auto heap = measure(options.reps, [&]() { std::ranges::fill(nodes, nullptr); }, [&]() {
+            for (auto& node: nodes) node = make();
+        });
+        report.add(name, R"("alloc": "heap")", n, "nodes", heap);
+
+        auto pooled = measure(options.reps, [&]() { std::ranges::fill(nodes, nullptr); arena.reset(); }, [&]() {
+            auto scope = micrograd::GraphArena::Scope{ arena };
+            for (auto& node: nodes) node = make();
+        });
+        report.add(name, R"("alloc": "arena")", n, "nodes", pooled);
+    }
+
+    std::ranges::fill(nodes, nullptr);
+}
+
+auto bench_backward(Report& report, const Options& options) -> void {
+    auto x = std::make_shared<Value>(1.0);
+    x->requires_grad = true;
+    auto root = ValuePtr{};
+
+    // Without retain_graph the timing includes freeing the graph, which the
+    // retaining runs leave to the next build
+    for (auto n: sizes_up_to(options.max_nodes)) {
+        // acc = (acc + x) * 0.5 repeated: a chain of n nodes
+        if (report.wants("backward/chain")) {
+            auto build = [&]() {
+                root = x;
+                for (std::size_t i = 0; i < n / 2; ++i) root = (root + x) * 0.5;
+            };
+            for (auto retain: { true, false }) {
+                auto r = measure(options.reps, build, [&]() { backward(root, { .retain_graph = retain }); });
+                report.add("backward/chain", std::format(R"("nodes": {}, "retain_graph": {})", n, retain), n, "nodes", r);
+            }
+        }
+
+        // Balanced binary tree of products over n / 2 distinct leaves
+        if (report.wants("backward/tree")) {
+            auto build = [&]() {
+                root = nullptr;
+                auto level = std::vector<ValuePtr>{};
+                for (std::size_t i = 0; i < n / 2; ++i) {
+                    level.push_back(std::make_shared<Value>(1.0));
+                    level.back()->requires_grad = true;
+                }
+                while (level.size() > 1) {
+                    auto next = std::vector<ValuePtr>{};
+                    for (std::size_t i = 0; i + 1 < level.size(); i += 2) next.push_back(level[i] * level[i + 1]);
+                    if (level.size() % 2 == 1) next.push_back(level.back());
+                    level = std::move(next);
+                }
+                root = level.front();
+            };
+            for (auto retain: { true, false }) {
+                auto r = measure(options.reps, build, [&]() { backward(root, { .retain_graph = retain }); });
+                report.add("backward/tree", std::format(R"("nodes": {}, "retain_graph": {})", n, retain), n, "nodes", r);
+            }
+        }
+    }
+}
+
+
+//
+// MLP
+//
+
+auto bench_mlp(Report& report, const Options& options) -> void {
+    constexpr std::size_t widths[] = { 16, 64, 256 };
+    constexpr std::size_t depths[] = { 2, 4 };
+    constexpr std::size_t batches[] = { 1, 32, 256 };
+
+    for (auto width: widths) {
+        for (auto depth: depths) {
+            for (auto batch: batches) {
+                auto nouts = std::vector<std::size_t>(depth, width);
+                nouts.push_back(1);
+                auto model = micrograd::MLP(width, nouts);
+
+                auto x = micrograd::Tensor(batch, width);
+                for (std::size_t i = 0; i < x.data.size(); ++i) x.data[i] = std::sin(static_cast<double>(i));
+
+                auto params = std::format(R"("width": {}, "depth": {}, "batch": {})", width, depth, batch);
+
+                // Graph per sample, summed into one loss
+                if (report.wants("mlp/dynamic") && width * width * depth * batch <= 16 * options.max_nodes) {
+                    auto rows = std::vector<std::vector<ValuePtr>>{};
+                    for (std::size_t r = 0; r < batch; ++r) {
+                        rows.emplace_back();
+                        for (auto v: x.row(r)) rows.back().push_back(std::make_shared<Value>(v));
+                    }
+
+                    auto arena = micrograd::GraphArena{};
+                    auto r = measure(options.reps, [&]() { arena.reset(); }, [&]() {
+                        auto scope = micrograd::GraphArena::Scope{ arena };
+                        auto outs = std::vector<ValuePtr>{};
+                        for (const auto& row: rows) outs.push_back(model(row)[0]);
+                        auto loss = micrograd::sum(outs);
+                        model.zero_grad();
+                        backward(loss);
+                    });
+                    report.add("mlp/dynamic", params, batch, "samples", r);
+                }
+
+                // Tensor path, in double and in float with double parameters
+                if (report.wants("mlp/batched")) {
+                    auto run = [&](const auto& input, const char* dtype) {
+                        auto acts = std::vector<std::remove_cvref_t<decltype(input)>>{};
+                        auto r = measure(options.reps, []() {}, [&]() {
+                            auto& out = model.forward(input, acts);
+                            std::ranges::fill(out.grad, 1);
+                            model.zero_grad();
+                            model.backward(acts);
+                        });
+                        report.add("mlp/batched", std::format(R"({}, "dtype": "{}")", params, dtype), batch, "samples", r);
+                    };
+                    run(x, "f64");
+                    run(x.cast<float>(), "f32");
+                }
+            }
+        }
+    }
+
+    // Deep tensor path with gradient checkpointing, act_bytes are the
+    // activations (values and gradients) held between forward and backward
+    if (report.wants("mlp/checkpoint")) {
+        constexpr std::size_t width = 256, depth = 16, batch = 256;
+        constexpr std::size_t intervals[] = { 1, 2, 4, 8 };
+
+        auto model = micrograd::MLP(width, std::vector<std::size_t>(depth, width));
+        auto x = micrograd::Tensor(batch, width);
+        for (std::size_t i = 0; i < x.data.size(); ++i) x.data[i] = std::sin(static_cast<double>(i));
+
+        for (auto k: intervals) {
+            model.set_checkpoint_every(k);
+
+            auto acts = std::vector<micrograd::Tensor>{};
+            std::size_t act_bytes = 0;
+            auto r = measure(options.reps, []() {}, [&]() {
+                auto& out = model.forward(x, acts);
+                act_bytes = 0;
+                for (const auto& a: acts) act_bytes += (a.data.size() + a.grad.size()) * sizeof(double);
+                std::ranges::fill(out.grad, 1.0);
+                model.zero_grad();
+                model.backward(acts);
+            });
+
+            auto params = std::format(R"("width": {}, "depth": {}, "batch": {}, "every": {}, "act_bytes": {})", width, depth, batch, k, act_bytes);
+            report.add("mlp/checkpoint", params, batch, "samples", r);
+        }
+    }
+
+    // Input gradients of a moons-sized model at n points: one forward-mode
+    // pass per input vs one reverse graph per point
+    if (report.wants("mlp/jacobian")) {
+        constexpr std::size_t n = 1'000;
+
+        auto model = micrograd::MLP(2, { 16, 16, 1 });
+        auto points = std::vector<std::array<double, 2>>(n);
+        for (std::size_t i = 0; i < n; ++i) points[i] = { std::sin(static_cast<double>(i)), std::cos(static_cast<double>(i)) };
+
+        auto forward = measure(options.reps, []() {}, [&]() {
+            for (const auto& p: points) static_cast<void>(model.jacobian(p));
+        });
+        report.add("mlp/jacobian", R"("mode": "forward")", n, "samples", forward);
+
+        auto reverse = measure(options.reps, []() {}, [&]() {
+            for (const auto& p: points) {
+                auto x = std::vector<ValuePtr>{ micrograd::leaf(p[0]), micrograd::leaf(p[1]) };
+                for (const auto& xi: x) xi->requires_grad = true;
+                model.zero_grad();
+                backward(model(x)[0]);
+            }
+        });
+        report.add("mlp/jacobian", R"("mode": "reverse")", n, "samples", reverse);
+    }
+}
+
+
+//
+// Training
+//
+
+// Mean hinge loss over the moons dataset
+auto moons_loss(const micrograd::MLP& model, const std::vector<std::vector<ValuePtr>>& X, std::span<const double> y) -> ValuePtr {
+    auto losses = std::vector<ValuePtr>{};
+    for (std::size_t i = 0; i < y.size(); ++i) {
+        losses.push_back(micrograd::relu(1.0 + (-y[i]) * model(X[i])[0]));
+    }
+    return micrograd::sum(losses) * (1.0 / static_cast<double>(y.size()));
+}
+
+auto bench_training(Report& report, const Options& options) -> void {
+    constexpr std::size_t steps = 20;
+
+    auto moons = micrograd::DatasetGenerator().make_moons(100, 0.1);
+    auto X = micrograd::to_values(moons);
+    auto y = moons.labels();
+
+    if (report.wants("train/moons_dynamic")) {
+        auto model = micrograd::MLP(2, { 16, 16, 1 });
+        auto optimizer = micrograd::SGD(model.parameter_values(), 0.1);
+        auto arena = micrograd::GraphArena{};
+
+        auto r = measure(options.reps, []() {}, [&]() {
+            for (std::size_t k = 0; k < steps; ++k) {
+                {
+                    auto scope = micrograd::GraphArena::Scope{ arena };
+                    auto loss = moons_loss(model, X, y);
+                    optimizer.zero_grad();
+                    backward(loss);
+                    optimizer.step();
+                }
+                arena.reset();
+            }
+        });
+        report.add("train/moons_dynamic", R"("samples": 100)", steps, "steps", r);
+    }
+
+    if (report.wants("train/moons_traced")) {
+        auto model = micrograd::MLP(2, { 16, 16, 1 });
+        auto optimizer = micrograd::SGD(model.parameter_values(), 0.1);
+        auto program = micrograd::Program::trace(moons_loss(model, X, y), model.parameters());
+
+        auto r = measure(options.reps, []() {}, [&]() {
+            for (std::size_t k = 0; k < steps; ++k) {
+                program.forward();
+                optimizer.zero_grad();
+                program.backward();
+                optimizer.step();
+            }
+        });
+        report.add("train/moons_traced", R"("samples": 100)", steps, "steps", r);
+    }
+
+    // Compiled once per graph, later runs load the cached object. Needs cc
+    // and minutes on the first run, so only with --compile
+    if (options.compile && report.wants("train/moons_compiled")) {
+        auto model = micrograd::MLP(2, { 16, 16, 1 });
+        auto optimizer = micrograd::SGD(model.parameter_values(), 0.1);
+        auto program = micrograd::Program::trace(moons_loss(model, X, y), model.parameters());
+        program.compile();
+
+        auto r = measure(options.reps, []() {}, [&]() {
+            for (std::size_t k = 0; k < steps; ++k) {
+                program.forward();
+                optimizer.zero_grad();
+                program.backward();
+                optimizer.step();
+            }
+        });
+        report.add("train/moons_compiled", R"("samples": 100)", steps, "steps", r);
+    }
+
+    if (report.wants("train/moons_batched")) {
+        auto model = micrograd::MLP(2, { 16, 16, 1 });
+        auto optimizer = micrograd::SGD(model.parameter_values(), 0.1);
+        auto x = micrograd::to_tensor(moons);
+        auto acts = std::vector<micrograd::Tensor>{};
+        auto n = static_cast<double>(y.size());
+
+        auto r = measure(options.reps, []() {}, [&]() {
+            for (std::size_t k = 0; k < steps; ++k) {
+                auto& scores = model.forward(x, acts);
+                for (std::size_t i = 0; i < y.size(); ++i) {
+                    scores.grad[i] = 1.0 - y[i] * scores.data[i] > 0.0 ? -y[i] / n : 0.0;
+                }
+                optimizer.zero_grad();
+                model.backward(acts);
+                optimizer.step();
+            }
+        });
+        report.add("train/moons_batched", R"("samples": 100)", steps, "steps", r);
+    }
+}
+
+// Hinge loss of the model on all of data, without building a graph
+auto moons_hinge(const micrograd::MLP& model, const micrograd::Dataset& data) -> double {
+    auto scores = model.predict(micrograd::to_tensor(data));
+    double loss = 0.0;
+    for (std::size_t i = 0; i < data.size(); ++i) loss += std::max(0.0, 1.0 - data.label(i) * scores.data[i]);
+    return loss / static_cast<double>(data.size());
+}
+
+// Plain single-threaded SGD against Hogwild on every hardware thread, same
+// learning rate, one update per sample, same initial weights. The final
+// loss goes into params to compare convergence next to the throughput.
+auto bench_hogwild(Report& report, const Options& options) -> void {
+    constexpr std::size_t samples = 20'000;
+    constexpr std::size_t epochs = 2;
+    constexpr double lr = 0.01;
+
+    auto moons = micrograd::DatasetGenerator().make_moons(samples, 0.1);
+    auto init = micrograd::MLP(2, { 16, 16, 1 });
+
+    auto sample_loss = [](const micrograd::MLP& m, std::span<const std::vector<ValuePtr>> xs, std::span<const double> ys) -> ValuePtr {
+        auto losses = std::vector<ValuePtr>{};
+        for (std::size_t i = 0; i < ys.size(); ++i) losses.push_back(micrograd::relu(1.0 + (-ys[i]) * m(xs[i])[0]));
+        return micrograd::sum(losses) * (1.0 / static_cast<double>(ys.size()));
+    };
+
+    auto reset_to_init = [&](micrograd::MLP& model) {
+        auto params = model.parameter_values();
+        auto init_params = init.parameter_values();
+        for (std::size_t i = 0; i < params.size(); ++i) params[i].data = init_params[i].data;
+    };
+
+    auto add = [&](const std::string& name, std::size_t n_threads, const micrograd::MLP& model, const Result& r) {
+        report.add(name, std::format(R"("samples": {}, "epochs": {}, "threads": {}, "final_loss": {:.4f})",
+            samples, epochs, n_threads, moons_hinge(model, moons)), samples * epochs, "samples", r);
+    };
+
+    if (report.wants("train/moons_sgd_serial")) {
+        auto model = init.clone();
+        auto optimizer = micrograd::SGD(model.parameter_values(), lr);
+        auto arena = micrograd::GraphArena{};
+        auto order = std::vector<std::size_t>(samples);
+        std::iota(order.begin(), order.end(), 0);
+        auto gen = std::mt19937_64{ 42 };
+
+        auto r = measure(options.reps, [&]() { reset_to_init(model); }, [&]() {
+            for (std::size_t epoch = 0; epoch < epochs; ++epoch) {
+                std::ranges::shuffle(order, gen);
+                for (auto i: order) {
+                    {
+                        auto scope = micrograd::GraphArena::Scope{ arena };
+                        auto x = std::array{ micrograd::to_values(moons.row(i)) };
+                        auto y = std::array{ moons.label(i) };
+                        auto loss = sample_loss(model, x, y);
+                        optimizer.zero_grad();
+                        backward(loss);
+                        optimizer.step();
+                    }
+                    arena.reset();
+                }
+            }
+        });
+        add("train/moons_sgd_serial", 1, model, r);
+    }
+
+    // On a single hardware thread Hogwild would just be a slower serial run
+    auto n_threads = std::size_t{ std::thread::hardware_concurrency() };
+    if (n_threads > 1 && report.wants("train/moons_hogwild")) {
+        auto model = init.clone();
+        auto pool = micrograd::ThreadPool{ n_threads };
+        auto trainer = micrograd::HogwildTrainer(model, pool, sample_loss, { .learning_rate = lr });
+
+        auto r = measure(options.reps, [&]() { reset_to_init(model); }, [&]() { trainer.train(moons, epochs); });
+        add("train/moons_hogwild", n_threads, model, r);
+    }
+}
+
+} // namespace
+
+
+auto main(int argc, char** argv) -> int {
+    auto options = Options{};
+    auto args = std::vector<std::string_view>(argv + 1, argv + argc);
+
+    for (std::size_t i = 0; i < args.size(); ++i) {
+        auto has_value = i + 1 < args.size();
+        if (args[i] == "--filter" && has_value) {
+            options.filter = args[++i];
+        } else if (args[i] == "--max-nodes" && has_value) {
+            options.max_nodes = std::stoul(std::string(args[++i]));
+        } else if (args[i] == "--reps" && has_value) {
+            options.reps = std::max<std::size_t>(std::stoul(std::string(args[++i])), 1);
+        } else if (args[i] == "--compile") {
+            options.compile = true;
+        } else {
+            std::cerr << "usage: bench [--filter substr] [--max-nodes n] [--reps n] [--compile]\n";
+            return 1;
+        }
+    }
+
+    auto report = Report{ options };
+
+    bench_ops(report, options);
+    bench_backward(report, options);
+    bench_mlp(report, options);
+    bench_training(report, options);
+    bench_hogwild(report, options);
+
+    report.finish();
+
+    return 0;
+}
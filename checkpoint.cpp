@@ -0,0 +1,260 @@
+#include "checkpoint.h"
+
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+namespace micrograd {
+
+
+namespace {
+
+struct Header {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t n_layers;
+    std::uint64_t nin;
+    std::uint64_t n_params;
+};
+
+struct LayerRecord {
+    std::uint64_t nout;
+    std::uint64_t nonlin;
+};
+
+static_assert(sizeof(Header) == 32 && sizeof(LayerRecord) == 16);
+
+} // namespace
+
+
+//
+// Save / load
+//
+
+auto save_checkpoint(const MLP& model, const std::string& filename) -> void {
+    const auto& layers = model.layers();
+    auto params = model.parameter_values();
+
+    auto header = Header{};
+    std::memcpy(header.magic, checkpoint::kMagic, sizeof(header.magic));
+    header.version = checkpoint::kVersion;
+    header.n_layers = static_cast<std::uint32_t>(layers.size());
+    header.nin = layers.front().nin();
+    header.n_params = params.size();
+
+    auto records = std::vector<LayerRecord>{};
+    for (const auto& layer: layers) {
+        records.push_back(LayerRecord{ layer.nout(), layer.nonlin() ? 1u : 0u });
+    }
+
+    auto weights = std::vector<double>{};
+    weights.reserve(params.size());
+    for (const auto& param: params) weights.push_back(param.data);
+
+    std::ofstream file(filename, std::ios::binary | std::ios::trunc);
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(records.data()), static_cast<std::streamsize>(records.size() * sizeof(LayerRecord)));
+    file.write(reinterpret_cast<const char*>(weights.data()), static_cast<std::streamsize>(weights.size() * sizeof(double)));
+
+    if (!file) {
+        throw std::runtime_error(std::format("Could not write checkpoint {}!", filename));
+    }
+}
+
+auto load_checkpoint(const std::string& filename) -> MLP {
+    return MappedModel(filename).to_mlp();
+}
+
+
+//
+// MappedModel
+//
+
+MappedModel::MappedModel(const std::string& filename):
+    base_{ nullptr },
+    size_{ 0 },
+    layers_{}
+{
+    auto fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error(std::format("Could not open checkpoint {}!", filename));
+    }
+
+    struct stat st{};
+    if (::fstat(fd, &st) != 0 || st.st_size < static_cast<off_t>(sizeof(Header))) {
+        ::close(fd);
+        throw std::runtime_error(std::format("Checkpoint {} is truncated!", filename));
+    }
+
+    size_ = static_cast<std::size_t>(st.st_size);
+    auto* base = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+
+    if (base == MAP_FAILED) {
+        throw std::runtime_error(std::format("Could not map checkpoint {}!", filename));
+    }
+    base_ = base;
+
+    // From here on the destructor does not run, so unmap on every error
+    auto fail = [&](std::string_view what) {
+        unmap();
+        throw std::runtime_error(std::format("Checkpoint {}: {}!", filename, what));
+    };
+
+    const auto* bytes = static_cast<const std::byte*>(base_);
+    const auto* header = reinterpret_cast<const Header*>(bytes);
+
+    if (std::memcmp(header->magic, checkpoint::kMagic, sizeof(header->magic)) != 0) fail("bad magic");
+    if (header->version != checkpoint::kVersion) fail(std::format("unsupported version {}", header->version));
+    if (header->n_layers == 0) fail("no layers");
+
+    auto records_size = std::size_t{ header->n_layers } * sizeof(LayerRecord);
+    if (size_ < sizeof(Header) + records_size) fail("truncated layer table");
+
+    if (header->n_params > size_ / sizeof(double)) fail("truncated parameters");
+
+    auto expected_size = sizeof(Header) + records_size + header->n_params * sizeof(double);
+    if (size_ != expected_size) fail(std::format("size {} does not match header ({})", size_, expected_size));
+
+    const auto* records = reinterpret_cast<const LayerRecord*>(bytes + sizeof(Header));
+    const auto* weights = reinterpret_cast<const double*>(bytes + sizeof(Header) + records_size);
+
+    std::size_t nin = header->nin;
+    std::size_t offset = 0;
+    for (std::uint32_t l = 0; l < header->n_layers; ++l) {
+        auto nout = static_cast<std::size_t>(records[l].nout);
+
+        // Bounds first, so that nout * (nin + 1) cannot overflow
+        auto remaining = header->n_params - offset;
+        if (nout == 0 || nin >= remaining || nout > remaining / (nin + 1)) {
+            fail(std::format("layer {} does not fit", l));
+        }
+        auto n = nout * (nin + 1);
+
+        layers_.push_back(LayerView{ nin, nout, records[l].nonlin != 0, { weights + offset, n } });
+
+        offset += n;
+        nin = nout;
+    }
+    if (offset != header->n_params) fail("parameter count does not match the layers");
+}
+
+MappedModel::~MappedModel() {
+    unmap();
+}
+
+MappedModel::MappedModel(MappedModel&& other) noexcept:
+    base_{ std::exchange(other.base_, nullptr) },
+    size_{ std::exchange(other.size_, 0) },
+    layers_{ std::move(other.layers_) }
+{}
+
+auto MappedModel::operator=(MappedModel&& other) noexcept -> MappedModel& {
+    if (this != &other) {
+        unmap();
+        base_ = std::exchange(other.base_, nullptr);
+        size_ = std::exchange(other.size_, 0);
+        layers_ = std::move(other.layers_);
+    }
+
+    return *this;
+}
+
+auto MappedModel::unmap() -> void {
+    if (base_ != nullptr) ::munmap(base_, size_);
+    base_ = nullptr;
+    size_ = 0;
+}
+
+auto MappedModel::predict(std::span<const double> x) const -> std::vector<double> {
+    if (x.size() != nin()) {
+        throw std::invalid_argument(
+            std::format("Inputs need to be the same size as the model's inputs ({})!", nin())
+        );
+    }
+
+    auto in = std::vector<double>(x.begin(), x.end());
+    auto out = std::vector<double>{};
+
+    for (const auto& [lnin, lnout, nonlin, params]: layers_) {
+        out.resize(lnout);
+
+        for (std::size_t j = 0; j < lnout; ++j) {
+            const auto* row = params.data() + j * (lnin + 1);
+
+            double act = row[lnin];
+            for (std::size_t i = 0; i < lnin; ++i) act += row[i] * in[i];
+
+            out[j] = nonlin ? std::tanh(act) : act;
+        }
+
+        std::swap(in, out);
+    }
+
+    return in;
+}
+
+auto MappedModel::predict(const Tensor& x) const -> Tensor {
+    if (x.cols() != nin()) {
+        throw std::invalid_argument(
+            std::format("Inputs need to have as many columns as the model has inputs ({})!", nin())
+        );
+    }
+
+    auto in = x;
+    for (const auto& [lnin, lnout, nonlin, params]: layers_) {
+        auto out = Tensor(in.rows(), lnout);
+
+        // Both the sample and the weight row are contiguous
+        for (std::size_t r = 0; r < in.rows(); ++r) {
+            auto sample = in.row(r);
+
+            for (std::size_t j = 0; j < lnout; ++j) {
+                const auto* row = params.data() + j * (lnin + 1);
+
+                double act = row[lnin];
+                for (std::size_t i = 0; i < lnin; ++i) act += row[i] * sample[i];
+
+                out(r, j) = nonlin ? std::tanh(act) : act;
+            }
+        }
+
+        in = std::move(out);
+    }
+
+    return in;
+}
+
+auto MappedModel::to_mlp() const -> MLP {
+    // MLP has tanh on every layer but the last
+    auto nouts = std::vector<std::size_t>{};
+    for (std::size_t l = 0; l < layers_.size(); ++l) {
+        if (layers_[l].nonlin != (l + 1 < layers_.size())) {
+            throw std::runtime_error(
+                std::format("Layer {} of the checkpoint has a nonlinearity MLP does not support!", l)
+            );
+        }
+        nouts.push_back(layers_[l].nout);
+    }
+
+    auto model = MLP(nin(), nouts);
+
+    auto params = model.parameter_values();
+    std::size_t i = 0;
+    for (const auto& layer: layers_) {
+        for (auto w: layer.params) params[i++].data = w;
+    }
+
+    return model;
+}
+
+
+} // namespace micrograd
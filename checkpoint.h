@@ -0,0 +1,90 @@
+#pragma once
+
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "nn.h"
+#include "tensor.h"
+
+
+namespace micrograd {
+
+
+// Binary MLP checkpoints.
+//
+// Layout, all fields little-endian and 8-byte aligned:
+//
+//   char[8]   magic "MGRDCKPT"
+//   u32       version
+//   u32       number of layers L
+//   u64       number of inputs
+//   u64       number of parameters P
+//   L times:  u64 nout, u64 nonlin (1 = tanh, 0 = linear)
+//   P times:  f64 parameter, in MLP::parameter_values() order
+//
+// The parameters are the rows [w_0 .. w_nin-1, b] of every neuron, layer
+// after layer, so a mapped file can be evaluated in place.
+namespace checkpoint {
+
+inline constexpr char kMagic[8] = { 'M', 'G', 'R', 'D', 'C', 'K', 'P', 'T' };
+inline constexpr std::uint32_t kVersion = 1;
+
+} // namespace checkpoint
+
+// Mapped weights are read as native doubles
+static_assert(std::endian::native == std::endian::little, "checkpoints are little-endian");
+
+
+auto save_checkpoint(const MLP& model, const std::string& filename) -> void;
+
+// Read a checkpoint into a new, trainable MLP
+auto load_checkpoint(const std::string& filename) -> MLP;
+
+
+// Read-only MLP served straight from a memory-mapped checkpoint. Nothing is
+// copied or allocated per weight, so opening a model costs one mmap and a
+// header check; pages are faulted in on first use.
+class MappedModel {
+public:
+    struct LayerView {
+        std::size_t nin;
+        std::size_t nout;
+        bool nonlin;
+        std::span<const double> params;  // nout rows of [w_0 .. w_nin-1, b]
+    };
+
+    explicit MappedModel(const std::string& filename);
+    ~MappedModel();
+
+    MappedModel(const MappedModel&) = delete;
+    auto operator=(const MappedModel&) -> MappedModel& = delete;
+
+    MappedModel(MappedModel&& other) noexcept;
+    auto operator=(MappedModel&& other) noexcept -> MappedModel&;
+
+    auto predict(std::span<const double> x) const -> std::vector<double>;
+
+    // Batched inference, one sample per row of x
+    auto predict(const Tensor& x) const -> Tensor;
+
+    // Copy of the weights into a trainable MLP
+    [[nodiscard]] auto to_mlp() const -> MLP;
+
+    auto nin() const -> std::size_t { return layers_.front().nin; }
+    auto nout() const -> std::size_t { return layers_.back().nout; }
+    auto layers() const -> const std::vector<LayerView>& { return layers_; }
+
+private:
+    auto unmap() -> void;
+
+    void* base_;
+    std::size_t size_;
+    std::vector<LayerView> layers_;
+};
+
+
+} // namespace micrograd
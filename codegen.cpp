@@ -0,0 +1,407 @@
+#include "trace.h"
+
+#include <cmath>
+#include <cstdlib>
+#include <format>
+#include <fstream>
+#include <optional>
+#include <span>
+#include <stdexcept>
+
+#if __has_include(<dlfcn.h>)
+#include <dlfcn.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define MICROGRAD_HAS_DLOPEN 1
+#endif
+
+
+namespace micrograd {
+
+
+namespace {
+
+// Instructions per generated function, one huge function compiles slowly
+constexpr std::size_t kChunk = 256;
+
+// Helpers for dot and sum. Operand lists of evenly spaced slots (neuron
+// weights, the outputs of a layer) become strided loads, others stay index
+// tables. Unrolled they would make up most of the source and compile many
+// times slower.
+constexpr const char* kPrelude = R"(/* Generated by micrograd::Program::compile() */
+#include <math.h>
+
+static double dot(const double* restrict d, const unsigned* ws, unsigned n) {
+    const unsigned* xs = ws + n;
+    double acc = 0.0;
+    for (unsigned i = 0; i < n; ++i) acc += d[ws[i]] * d[xs[i]];
+    return acc;
+}
+
+static double sum(const double* restrict d, const unsigned* xs, unsigned n) {
+    double acc = 0.0;
+    for (unsigned i = 0; i < n; ++i) acc += d[xs[i]];
+    return acc;
+}
+
+static void dot_backward(const double* restrict d, double* restrict g, const unsigned* ws, unsigned n, double out) {
+    const unsigned* xs = ws + n;
+    for (unsigned i = 0; i < n; ++i) {
+        g[ws[i]] += d[xs[i]] * out;
+        g[xs[i]] += d[ws[i]] * out;
+    }
+}
+
+static void sum_backward(double* restrict g, const unsigned* xs, unsigned n, double out) {
+    for (unsigned i = 0; i < n; ++i) g[xs[i]] += out;
+}
+
+static double dot_strided(const double* w, long sw, const double* x, long sx, long n) {
+    double acc = 0.0;
+    for (long i = 0; i < n; ++i) acc += w[i * sw] * x[i * sx];
+    return acc;
+}
+
+static double sum_strided(const double* x, long sx, long n) {
+    double acc = 0.0;
+    for (long i = 0; i < n; ++i) acc += x[i * sx];
+    return acc;
+}
+
+static void dot_strided_backward(const double* w, long sw, const double* x, long sx, double* gw, double* gx, long n, double out) {
+    for (long i = 0; i < n; ++i) {
+        gw[i * sw] += x[i * sx] * out;
+        gx[i * sx] += w[i * sw] * out;
+    }
+}
+
+static void sum_strided_backward(double* gx, long sx, long n, double out) {
+    for (long i = 0; i < n; ++i) gx[i * sx] += out;
+}
+)";
+
+// C literal that parses back to exactly v
+auto literal(double v) -> std::string {
+    if (std::isnan(v)) return "NAN";
+    if (std::isinf(v)) return v > 0 ? "INFINITY" : "(-INFINITY)";
+
+    auto s = std::format("{}", v);
+    if (s.find_first_of(".e") == std::string::npos) s += ".0";
+    return v < 0 ? "(" + s + ")" : s;
+}
+
+// FNV-1a, stable across runs and platforms
+auto hash(const std::string& s) -> std::uint64_t {
+    auto h = std::uint64_t{ 14695981039346656037ull };
+    for (auto c: s) {
+        h ^= static_cast<unsigned char>(c);
+        h *= 1099511628211ull;
+    }
+    return h;
+}
+
+// Distance between consecutive slots if they are evenly spaced
+auto stride(std::span<const std::uint32_t> slots) -> std::optional<std::int64_t> {
+    if (slots.size() < 2) return 0;
+
+    auto step = std::int64_t{ slots[1] } - std::int64_t{ slots[0] };
+    for (std::size_t i = 2; i < slots.size(); ++i) {
+        if (std::int64_t{ slots[i] } - std::int64_t{ slots[i - 1] } != step) return std::nullopt;
+    }
+    return step;
+}
+
+} // namespace
+
+
+//
+// Code generation
+//
+
+// Mirrors the interpreter expression by expression, so without fast-math the
+// native program computes the same values bit for bit
+auto Program::generate() const -> std::string {
+    auto src = std::string{};
+    auto chunks = (code_.size() + kChunk - 1) / kChunk;
+    bool table = false;
+
+    auto d = [](std::uint32_t i) { return std::format("d[{}]", i); };
+    auto g = [](std::uint32_t i) { return std::format("g[{}]", i); };
+
+    // Operands [offset, offset + n) of a dot or sum
+    auto slots = [&](std::uint32_t offset, std::uint32_t n) {
+        return std::span<const std::uint32_t>{ args_.data() + offset, n };
+    };
+
+    for (std::size_t c = 0; c < chunks; ++c) {
+        src += std::format("\nstatic void forward_{}(double* restrict d) {{\n", c);
+
+        for (std::size_t i = c * kChunk; i < std::min(code_.size(), (c + 1) * kChunk); ++i) {
+            const auto& [op, out, a, b, saved] = code_[i];
+            auto k = literal(saved);
+
+            switch (op) {
+            case Op::leaf:
+            case Op::fused:  // rejected by trace()
+            case Op::released:  // rejected by trace()
+                break;
+            case Op::add: src += std::format("    {} = {} + {};\n", d(out), d(a), d(b)); break;
+            case Op::add_const: src += std::format("    {} = {} + {};\n", d(out), d(a), k); break;
+            case Op::sub: src += std::format("    {} = {} - {};\n", d(out), d(a), d(b)); break;
+            case Op::rsub_const: src += std::format("    {} = {} - {};\n", d(out), k, d(a)); break;
+            case Op::neg: src += std::format("    {} = -{};\n", d(out), d(a)); break;
+            case Op::mul: src += std::format("    {} = {} * {};\n", d(out), d(a), d(b)); break;
+            case Op::mul_const: src += std::format("    {} = {} * {};\n", d(out), d(a), k); break;
+            case Op::div: src += std::format("    {} = {} / {};\n", d(out), d(a), d(b)); break;
+            case Op::rdiv_const: src += std::format("    {} = {} / {};\n", d(out), k, d(a)); break;
+            case Op::pow: src += std::format("    {} = pow({}, {});\n", d(out), d(a), d(b)); break;
+            case Op::pow_const: src += std::format("    {} = pow({}, {});\n", d(out), d(a), k); break;
+            case Op::exp: src += std::format("    {} = exp({});\n", d(out), d(a)); break;
+            case Op::tanh:
+                src += std::format("    {0} = (exp(2 * {1}) - 1) / (exp(2 * {1}) + 1);\n", d(out), d(a));
+                break;
+            case Op::relu: src += std::format("    {0} = {1} < 0.0 ? 0.0 : {1};\n", d(out), d(a)); break;
+            case Op::dot: {
+                auto ws = slots(a, b / 2);
+                auto xs = slots(a + b / 2, b / 2);
+                auto sw = stride(ws);
+                auto sx = stride(xs);
+                if (sw && sx) {
+                    src += std::format("    {} = dot_strided(d + {}, {}, d + {}, {}, {});\n", d(out), ws[0], *sw, xs[0], *sx, b / 2);
+                } else {
+                    src += std::format("    {} = dot(d, args + {}, {});\n", d(out), a, b / 2);
+                    table = true;
+                }
+                break;
+            }
+            case Op::sum: {
+                auto xs = slots(a, b);
+                if (auto sx = stride(xs)) {
+                    src += std::format("    {} = sum_strided(d + {}, {}, {});\n", d(out), xs[0], *sx, b);
+                } else {
+                    src += std::format("    {} = sum(d, args + {}, {});\n", d(out), a, b);
+                    table = true;
+                }
+                break;
+            }
+            }
+        }
+
+        src += "}\n";
+    }
+
+    for (std::size_t c = 0; c < chunks; ++c) {
+        src += std::format("\nstatic void backward_{}(const double* restrict d, double* restrict g) {{\n", c);
+
+        for (std::size_t i = std::min(code_.size(), (c + 1) * kChunk); i-- > c * kChunk;) {
+            const auto& [op, out, a, b, saved] = code_[i];
+            auto k = literal(saved);
+
+            switch (op) {
+            case Op::leaf:
+            case Op::fused:  // rejected by trace()
+            case Op::released:  // rejected by trace()
+                break;
+            case Op::add:
+                src += std::format("    {} += {};\n    {} += {};\n", g(a), g(out), g(b), g(out));
+                break;
+            case Op::add_const: src += std::format("    {} += {};\n", g(a), g(out)); break;
+            case Op::sub:
+                src += std::format("    {} += {};\n    {} -= {};\n", g(a), g(out), g(b), g(out));
+                break;
+            case Op::rsub_const:
+            case Op::neg:
+                src += std::format("    {} -= {};\n", g(a), g(out));
+                break;
+            case Op::mul:
+                src += std::format("    {} += {} * {};\n    {} += {} * {};\n", g(a), d(b), g(out), g(b), d(a), g(out));
+                break;
+            case Op::mul_const: src += std::format("    {} += {} * {};\n", g(a), k, g(out)); break;
+            case Op::div:
+                src += std::format("    {} += {} / {};\n", g(a), g(out), d(b));
+                src += std::format("    {} -= {} / {} * {};\n", g(b), d(out), d(b), g(out));
+                break;
+            case Op::rdiv_const: src += std::format("    {} -= {} / {} * {};\n", g(a), d(out), d(a), g(out)); break;
+            case Op::pow:
+                src += std::format("    {} += ({} * pow({}, {} - 1)) * {};\n", g(a), d(b), d(a), d(b), g(out));
+                src += std::format("    {} += ({} * log({})) * {};\n", g(b), d(out), d(a), g(out));
+                break;
+            case Op::pow_const:
+                src += std::format("    {} += ({} * pow({}, {} - 1)) * {};\n", g(a), k, d(a), k, g(out));
+                break;
+            case Op::exp: src += std::format("    {} += {} * {};\n", g(a), d(out), g(out)); break;
+            case Op::tanh:
+                src += std::format("    {} += (1 - {} * {}) * {};\n", g(a), d(out), d(out), g(out));
+                break;
+            case Op::relu:
+                src += std::format("    {} += ({} > 0 ? 1.0 : 0.0) * {};\n", g(a), d(out), g(out));
+                break;
+            case Op::dot: {
+                auto ws = slots(a, b / 2);
+                auto xs = slots(a + b / 2, b / 2);
+                auto sw = stride(ws);
+                auto sx = stride(xs);
+                if (sw && sx) {
+                    src += std::format("    dot_strided_backward(d + {0}, {1}, d + {2}, {3}, g + {0}, g + {2}, {4}, {5});\n",
+                        ws[0], *sw, xs[0], *sx, b / 2, g(out));
+                } else {
+                    src += std::format("    dot_backward(d, g, args + {}, {}, {});\n", a, b / 2, g(out));
+                }
+                break;
+            }
+            case Op::sum: {
+                auto xs = slots(a, b);
+                if (auto sx = stride(xs)) {
+                    src += std::format("    sum_strided_backward(g + {}, {}, {}, {});\n", xs[0], *sx, b, g(out));
+                } else {
+                    src += std::format("    sum_backward(g, args + {}, {}, {});\n", a, b, g(out));
+                }
+                break;
+            }
+            }
+        }
+
+        src += "}\n";
+    }
+
+    // Entry points, backward runs the chunks in reverse
+    src += "\nvoid micrograd_forward(double* restrict d) {\n";
+    for (std::size_t c = 0; c < chunks; ++c) src += std::format("    forward_{}(d);\n", c);
+    src += "}\n\nvoid micrograd_backward(const double* restrict d, double* restrict g) {\n";
+    for (std::size_t c = chunks; c-- > 0;) src += std::format("    backward_{}(d, g);\n", c);
+    src += "}\n";
+
+    if (!table) return kPrelude + src;
+
+    auto args = std::string{ "\nstatic const unsigned args[] = {" };
+    for (std::size_t i = 0; i < args_.size(); ++i) {
+        args += std::format("{}{},", i % 16 == 0 ? "\n    " : " ", args_[i]);
+    }
+    args += "\n};\n";
+
+    return kPrelude + args + src;
+}
+
+
+//
+// Compilation
+//
+
+#ifdef MICROGRAD_HAS_DLOPEN
+
+namespace {
+
+// Single-quoted for the POSIX shell, so std::system() sees one plain word
+auto quote(const std::string& s) -> std::string {
+    auto quoted = std::string{ "'" };
+    for (auto c: s) {
+        if (c == '\'') {
+            quoted += "'\\''";
+        } else {
+            quoted += c;
+        }
+    }
+    return quoted + "'";
+}
+
+// $XDG_CACHE_HOME/micrograd, falling back to $HOME/.cache/micrograd
+auto default_cache_dir() -> std::filesystem::path {
+    if (const auto* xdg = std::getenv("XDG_CACHE_HOME"); xdg != nullptr && *xdg == '/') {
+        return std::filesystem::path{ xdg } / "micrograd";
+    }
+    if (const auto* home = std::getenv("HOME"); home != nullptr && *home != '\0') {
+        return std::filesystem::path{ home } / ".cache" / "micrograd";
+    }
+    throw std::runtime_error("Program::compile: neither XDG_CACHE_HOME nor HOME is set, pass a cache_dir!");
+}
+
+// Only files of this user that nobody else can write may be loaded or
+// written into, anything else could have been planted by another user
+auto check_private(const std::filesystem::path& path) -> void {
+    struct stat st{};
+    if (::lstat(path.c_str(), &st) != 0) {
+        throw std::runtime_error(std::format("Program::compile: cannot stat {}!", path.string()));
+    }
+    if (st.st_uid != ::geteuid() || (st.st_mode & (S_IWGRP | S_IWOTH)) != 0) {
+        throw std::runtime_error(std::format(
+            "Program::compile: {} must be owned by the current user and not writable by group or others!", path.string()
+        ));
+    }
+}
+
+} // namespace
+
+auto Program::compile(const CompileOptions& options) -> void {
+    auto src = generate();
+
+    // Every word quoted, so neither the options nor the paths reach the shell
+    auto command = quote(options.compiler);
+    for (std::size_t begin = 0; (begin = options.flags.find_first_not_of(" \t", begin)) != std::string::npos;) {
+        auto end = options.flags.find_first_of(" \t", begin);
+        command += " " + quote(options.flags.substr(begin, end - begin));
+        begin = end;
+    }
+    command += " -shared -fPIC";
+
+    auto dir = options.cache_dir.empty() ? default_cache_dir() : options.cache_dir;
+    if (std::filesystem::create_directories(dir)) {
+        std::filesystem::permissions(dir, std::filesystem::perms::owner_all, std::filesystem::perm_options::replace);
+    }
+    check_private(dir);
+
+    auto key = std::format("program_{:016x}", hash(command + "\n" + src));
+    auto object = dir / (key + ".so");
+
+    // Build under a private name and rename, so concurrent processes never
+    // load a half-written object
+    if (!std::filesystem::exists(object)) {
+        auto pid = std::to_string(::getpid());
+        auto source = dir / (key + "." + pid + ".c");
+        auto partial = dir / (key + "." + pid + ".so");
+
+        auto out = std::ofstream(source);
+        out << src;
+        out.close();
+        if (!out) {
+            std::filesystem::remove(source);
+            throw std::runtime_error(std::format("Program::compile: could not write {}!", source.string()));
+        }
+
+        auto status = std::system(std::format("{} -o {} {} -lm", command, quote(partial.string()), quote(source.string())).c_str());
+        if (status != 0) {
+            std::filesystem::remove(source);
+            std::filesystem::remove(partial);
+            throw std::runtime_error(std::format("Program::compile: '{}' failed on {} with status {}!", command, source.string(), status));
+        }
+
+        std::filesystem::rename(partial, object);
+        std::filesystem::rename(source, dir / (key + ".c"));
+    }
+
+    check_private(object);
+
+    auto* handle = ::dlopen(object.c_str(), RTLD_NOW | RTLD_LOCAL);
+    if (handle == nullptr) {
+        throw std::runtime_error(std::format("Program::compile: could not load {} ({})!", object.string(), ::dlerror()));
+    }
+    library_ = std::shared_ptr<void>(handle, [](void* h) { ::dlclose(h); });
+
+    native_forward_ = reinterpret_cast<NativeForward>(::dlsym(handle, "micrograd_forward"));
+    native_backward_ = reinterpret_cast<NativeBackward>(::dlsym(handle, "micrograd_backward"));
+    if (native_forward_ == nullptr || native_backward_ == nullptr) {
+        native_forward_ = nullptr;
+        native_backward_ = nullptr;
+        throw std::runtime_error(std::format("Program::compile: {} lacks the generated entry points!", object.string()));
+    }
+}
+
+#else
+
+auto Program::compile(const CompileOptions&) -> void {
+    throw std::runtime_error("Program::compile: loading native code needs dlopen, which this platform lacks!");
+}
+
+#endif
+
+
+} // namespace micrograd
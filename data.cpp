@@ -0,0 +1,484 @@
+#include "data.h"
+
+#include <algorithm>
+#include <bit>
+#include <charconv>
+#include <cstring>
+#include <limits>
+#include <numeric>
+#include <random>
+#include <stdexcept>
+#include <utility>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+namespace micrograd {
+
+
+namespace {
+
+constexpr char kMagic[8] = { 'M', 'G', 'R', 'D', 'D', 'S', 'E', 'T' };
+constexpr std::uint32_t kVersion = 1;
+
+struct Header {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t reserved;
+    std::uint64_t n_samples;
+    std::uint64_t n_features;
+};
+
+static_assert(sizeof(Header) == 32);
+static_assert(std::endian::native == std::endian::little, "datasets are little-endian");
+
+} // namespace
+
+
+//
+// DatasetView
+//
+
+DatasetView::DatasetView(std::span<const double> features, std::span<const double> labels, std::size_t n_features):
+    features_{ features },
+    labels_{ labels },
+    n_features_{ n_features }
+{
+    if (features.size() != labels.size() * n_features) {
+        throw std::invalid_argument(
+            std::format("Features need to hold {} values per label!", n_features)
+        );
+    }
+}
+
+auto DatasetView::subview(std::size_t begin, std::size_t n) const -> DatasetView {
+    return { features_.subspan(begin * n_features_, n * n_features_), labels_.subspan(begin, n), n_features_ };
+}
+
+
+//
+// Dataset
+//
+
+Dataset::Dataset(std::size_t n_features):
+    features_{},
+    labels_{},
+    n_features_{ n_features }
+{}
+
+auto Dataset::push_back(std::span<const double> x, double y) -> void {
+    if (labels_.empty() && n_features_ == 0) n_features_ = x.size();
+
+    if (x.size() != n_features_) {
+        throw std::invalid_argument(
+            std::format("Samples need to have {} features!", n_features_)
+        );
+    }
+
+    features_.insert(features_.end(), x.begin(), x.end());
+    labels_.push_back(y);
+}
+
+auto Dataset::reserve(std::size_t n_samples) -> void {
+    features_.reserve(n_samples * n_features_);
+    labels_.reserve(n_samples);
+}
+
+
+//
+// MappedDataset
+//
+
+MappedDataset::MappedDataset(const std::string& filename):
+    base_{ nullptr },
+    size_{ 0 },
+    view_{}
+{
+    auto fd = ::open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error(std::format("Could not open dataset {}!", filename));
+    }
+
+    struct stat st{};
+    if (::fstat(fd, &st) != 0 || st.st_size < static_cast<off_t>(sizeof(Header))) {
+        ::close(fd);
+        throw std::runtime_error(std::format("Dataset {} is truncated!", filename));
+    }
+
+    size_ = static_cast<std::size_t>(st.st_size);
+    auto* base = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+
+    if (base == MAP_FAILED) {
+        throw std::runtime_error(std::format("Could not map dataset {}!", filename));
+    }
+    base_ = base;
+
+    // From here on the destructor does not run, so unmap on every error
+    auto fail = [&](std::string_view what) {
+        unmap();
+        throw std::runtime_error(std::format("Dataset {}: {}!", filename, what));
+    };
+
+    const auto* bytes = static_cast<const std::byte*>(base_);
+    const auto* header = reinterpret_cast<const Header*>(bytes);
+
+    if (std::memcmp(header->magic, kMagic, sizeof(header->magic)) != 0) fail("bad magic");
+    if (header->version != kVersion) fail(std::format("unsupported version {}", header->version));
+
+    // Bounds first, so that the size computation cannot overflow
+    auto max_values = (size_ - sizeof(Header)) / sizeof(double);
+    auto n = header->n_samples;
+    auto d = header->n_features;
+    if (n > max_values || (n > 0 && d > max_values / n - 1)) fail("truncated data");
+
+    auto expected_size = sizeof(Header) + (n * d + n) * sizeof(double);
+    if (size_ != expected_size) fail(std::format("size {} does not match header ({})", size_, expected_size));
+
+    const auto* features = reinterpret_cast<const double*>(bytes + sizeof(Header));
+    view_ = DatasetView({ features, n * d }, { features + n * d, n }, d);
+}
+
+MappedDataset::~MappedDataset() {
+    unmap();
+}
+
+MappedDataset::MappedDataset(MappedDataset&& other) noexcept:
+    base_{ std::exchange(other.base_, nullptr) },
+    size_{ std::exchange(other.size_, 0) },
+    view_{ std::exchange(other.view_, DatasetView{}) }
+{}
+
+auto MappedDataset::operator=(MappedDataset&& other) noexcept -> MappedDataset& {
+    if (this != &other) {
+        unmap();
+        base_ = std::exchange(other.base_, nullptr);
+        size_ = std::exchange(other.size_, 0);
+        view_ = std::exchange(other.view_, DatasetView{});
+    }
+
+    return *this;
+}
+
+auto MappedDataset::unmap() -> void {
+    if (base_ != nullptr) ::munmap(base_, size_);
+    base_ = nullptr;
+    size_ = 0;
+    view_ = DatasetView{};
+}
+
+
+//
+// Minibatches
+//
+
+Minibatches::Minibatches(DatasetView data, std::size_t batch_size):
+    data_{ data },
+    batch_size_{ batch_size }
+{
+    if (batch_size == 0) {
+        throw std::invalid_argument("Batch size needs to be positive!");
+    }
+}
+
+auto Minibatches::Iterator::operator*() const -> DatasetView {
+    return data_.subview(begin_, std::min(batch_size_, data_.size() - begin_));
+}
+
+
+//
+// DataLoader
+//
+
+template <typename T>
+BasicDataLoader<T>::BasicDataLoader(DatasetView data, std::size_t batch_size, DataLoaderOptions options):
+    data_{ data },
+    batch_size_{ batch_size },
+    options_{ options },
+    mutex_{},
+    not_full_{},
+    not_empty_{},
+    queue_{},
+    error_{},
+    stop_{ false },
+    worker_{}
+{
+    if (batch_size == 0) {
+        throw std::invalid_argument("Batch size needs to be positive!");
+    }
+    if (batches_per_epoch() == 0) {
+        throw std::invalid_argument(
+            std::format("Dataset of {} samples yields no batch of size {}!", data.size(), batch_size)
+        );
+    }
+    options_.prefetch = std::max<std::size_t>(options_.prefetch, 1);
+
+    worker_ = std::thread([this]() { worker_loop(); });
+}
+
+template <typename T>
+BasicDataLoader<T>::~BasicDataLoader() {
+    {
+        auto lock = std::lock_guard{ mutex_ };
+        stop_ = true;
+    }
+    not_full_.notify_all();
+
+    worker_.join();
+}
+
+template <typename T>
+auto BasicDataLoader<T>::batches_per_epoch() const -> std::size_t {
+    return options_.drop_last
+        ? data_.size() / batch_size_
+        : (data_.size() + batch_size_ - 1) / batch_size_;
+}
+
+template <typename T>
+auto BasicDataLoader<T>::next() -> std::optional<BasicBatch<T>> {
+    auto lock = std::unique_lock{ mutex_ };
+    not_empty_.wait(lock, [this]() { return !queue_.empty() || error_; });
+
+    if (queue_.empty()) std::rethrow_exception(error_);
+
+    auto batch = std::move(queue_.front());
+    queue_.pop_front();
+
+    lock.unlock();
+    not_full_.notify_one();
+
+    return batch;
+}
+
+template <typename T>
+auto BasicDataLoader<T>::push(std::optional<BasicBatch<T>> batch) -> bool {
+    auto lock = std::unique_lock{ mutex_ };
+    not_full_.wait(lock, [this]() { return stop_ || queue_.size() < options_.prefetch; });
+    if (stop_) return false;
+
+    queue_.push_back(std::move(batch));
+
+    lock.unlock();
+    not_empty_.notify_one();
+
+    return true;
+}
+
+template <typename T>
+auto BasicDataLoader<T>::worker_loop() -> void {
+    try {
+        auto gen = std::mt19937_64{ options_.seed };
+        auto order = std::vector<std::size_t>(data_.size());
+        std::iota(order.begin(), order.end(), 0);
+
+        auto n_features = data_.n_features();
+        auto n_batches = batches_per_epoch();
+
+        while (true) {
+            if (options_.shuffle) std::ranges::shuffle(order, gen);
+
+            for (std::size_t b = 0; b < n_batches; ++b) {
+                auto begin = b * batch_size_;
+                auto n = std::min(batch_size_, data_.size() - begin);
+
+                // Gather the rows, they are scattered after shuffling
+                auto batch = BasicBatch<T>{ BasicTensor<T>(n, n_features), std::vector<T>(n) };
+                for (std::size_t i = 0; i < n; ++i) {
+                    std::ranges::transform(data_.row(order[begin + i]), batch.x.row(i).begin(), [](double v) { return static_cast<T>(v); });
+                    batch.y[i] = static_cast<T>(data_.label(order[begin + i]));
+                }
+
+                if (!push(std::move(batch))) return;
+            }
+
+            if (!push(std::nullopt)) return;
+        }
+    } catch (...) {
+        auto lock = std::lock_guard{ mutex_ };
+        error_ = std::current_exception();
+        not_empty_.notify_all();
+    }
+}
+
+
+//
+// CSV
+//
+
+CsvReader::CsvReader(const std::string& filename):
+    file_{ filename },
+    filename_{ filename },
+    line_{},
+    header_{},
+    line_number_{ 0 },
+    pending_{ false }
+{
+    if (!file_) {
+        throw std::runtime_error(std::format("Could not open {}!", filename));
+    }
+
+    // Keep the first line as a record if it is all numbers
+    auto fields = std::vector<double>{};
+    if (!std::getline(file_, line_)) return;
+    ++line_number_;
+
+    if (parse(line_, fields)) {
+        pending_ = true;
+        return;
+    }
+
+    std::size_t begin = 0;
+    while (begin <= line_.size()) {
+        auto end = std::min(line_.find(',', begin), line_.size());
+        auto name = line_.substr(begin, end - begin);
+        if (!name.empty() && name.back() == '\r') name.pop_back();
+        header_.push_back(std::move(name));
+        begin = end + 1;
+    }
+}
+
+auto CsvReader::next(std::vector<double>& fields) -> bool {
+    while (pending_ || std::getline(file_, line_)) {
+        if (!pending_) ++line_number_;
+        pending_ = false;
+
+        // Blank lines separate nothing
+        if (line_.empty() || line_ == "\r") continue;
+
+        if (!parse(line_, fields)) {
+            throw std::runtime_error(
+                std::format("{}:{}: record is not a list of numbers!", filename_, line_number_)
+            );
+        }
+        return true;
+    }
+
+    return false;
+}
+
+auto CsvReader::parse(const std::string& line, std::vector<double>& fields) const -> bool {
+    fields.clear();
+
+    const auto* p = line.data();
+    const auto* end = line.data() + line.size();
+    if (p != end && end[-1] == '\r') --end;
+
+    while (true) {
+        while (p != end && *p == ' ') ++p;
+
+        double value = 0.0;
+        auto [ptr, ec] = std::from_chars(p, end, value);
+        if (ec != std::errc{}) return false;
+        fields.push_back(value);
+
+        p = ptr;
+        while (p != end && *p == ' ') ++p;
+
+        if (p == end) return true;
+        if (*p++ != ',') return false;
+    }
+}
+
+auto read_csv(const std::string& filename) -> Dataset {
+    auto reader = CsvReader{ filename };
+    auto ds = Dataset{};
+    auto fields = std::vector<double>{};
+
+    while (reader.next(fields)) {
+        if (fields.size() < 2) {
+            throw std::runtime_error(std::format("{}: records need features and a label!", filename));
+        }
+        ds.push_back(std::span(fields).first(fields.size() - 1), fields.back());
+    }
+
+    return ds;
+}
+
+auto save_csv(DatasetView data, const std::string& filename) -> void {
+    std::ofstream file(filename);
+
+    // Enough digits for read_csv() to restore every double exactly
+    file.precision(std::numeric_limits<double>::max_digits10);
+
+    if (data.n_features() == 2) {
+        file << "x,y,";
+    } else {
+        for (std::size_t j = 0; j < data.n_features(); ++j) file << "x" << j << ",";
+    }
+    file << "label\n";
+
+    for (std::size_t i = 0; i < data.size(); ++i) {
+        for (auto x: data.row(i)) file << x << ",";
+        file << data.label(i) << "\n";
+    }
+
+    if (!file) {
+        throw std::runtime_error(std::format("Could not write {}!", filename));
+    }
+}
+
+
+//
+// Binary
+//
+
+auto save_binary(DatasetView data, const std::string& filename) -> void {
+    auto header = Header{};
+    std::memcpy(header.magic, kMagic, sizeof(header.magic));
+    header.version = kVersion;
+    header.reserved = 0;
+    header.n_samples = data.size();
+    header.n_features = data.n_features();
+
+    std::ofstream file(filename, std::ios::binary | std::ios::trunc);
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(data.features().data()), static_cast<std::streamsize>(data.features().size_bytes()));
+    file.write(reinterpret_cast<const char*>(data.labels().data()), static_cast<std::streamsize>(data.labels().size_bytes()));
+
+    if (!file) {
+        throw std::runtime_error(std::format("Could not write dataset {}!", filename));
+    }
+}
+
+template class BasicDataLoader<double>;
+template class BasicDataLoader<float>;
+
+
+//
+// Graph inputs
+//
+
+auto to_values(std::span<const double> x) -> std::vector<ValuePtr> {
+    auto values = std::vector<ValuePtr>{};
+    values.reserve(x.size());
+
+    for (auto v: x) values.push_back(leaf(v));
+
+    return values;
+}
+
+auto to_values(DatasetView data) -> std::vector<std::vector<ValuePtr>> {
+    auto rows = std::vector<std::vector<ValuePtr>>{};
+    rows.reserve(data.size());
+
+    for (std::size_t i = 0; i < data.size(); ++i) rows.push_back(to_values(data.row(i)));
+
+    return rows;
+}
+
+template <typename T>
+auto to_tensor(DatasetView data) -> BasicTensor<T> {
+    auto x = BasicTensor<T>(data.size(), data.n_features());
+    std::ranges::transform(data.features(), x.data.begin(), [](double v) { return static_cast<T>(v); });
+
+    return x;
+}
+
+template auto to_tensor<double>(DatasetView data) -> Tensor;
+template auto to_tensor<float>(DatasetView data) -> FloatTensor;
+
+
+} // namespace micrograd
@@ -0,0 +1,264 @@
+#pragma once
+
+#include <concepts>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <fstream>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "engine.h"
+#include "tensor.h"
+
+
+namespace micrograd {
+
+
+// Non-owning view of samples stored row-major: row i of features holds the
+// n_features values of sample i, labels[i] its target. Views into a Dataset
+// or MappedDataset are cheap to copy and slice.
+class DatasetView {
+public:
+    DatasetView() = default;
+    DatasetView(std::span<const double> features, std::span<const double> labels, std::size_t n_features);
+
+    auto size() const -> std::size_t { return labels_.size(); }
+    auto empty() const -> bool { return labels_.empty(); }
+    auto n_features() const -> std::size_t { return n_features_; }
+
+    auto row(std::size_t i) const -> std::span<const double> {
+        return features_.subspan(i * n_features_, n_features_);
+    }
+    auto label(std::size_t i) const -> double { return labels_[i]; }
+
+    auto features() const -> std::span<const double> { return features_; }
+    auto labels() const -> std::span<const double> { return labels_; }
+
+    // Samples [begin, begin + n)
+    auto subview(std::size_t begin, std::size_t n) const -> DatasetView;
+
+private:
+    std::span<const double> features_{};
+    std::span<const double> labels_{};
+    std::size_t n_features_{ 0 };
+};
+
+
+// Samples with double features in one contiguous row-major buffer, no
+// per-scalar allocations. ValuePtrs are only created (see to_values()) when
+// a graph is built from a sample.
+class Dataset {
+public:
+    explicit Dataset(std::size_t n_features = 0);
+
+    auto push_back(std::span<const double> x, double y) -> void;
+    auto reserve(std::size_t n_samples) -> void;
+
+    auto size() const -> std::size_t { return labels_.size(); }
+    auto n_features() const -> std::size_t { return n_features_; }
+
+    auto row(std::size_t i) const -> std::span<const double> { return view().row(i); }
+    auto label(std::size_t i) const -> double { return labels_[i]; }
+
+    auto features() const -> std::span<const double> { return features_; }
+    auto labels() const -> std::span<const double> { return labels_; }
+
+    // Views into the buffers, so not from a temporary that frees them
+    auto view() const& -> DatasetView { return { features_, labels_, n_features_ }; }
+    auto view() const&& -> DatasetView = delete;
+    operator DatasetView() const& { return view(); }
+    operator DatasetView() const&& = delete;
+
+private:
+    std::vector<double> features_;
+    std::vector<double> labels_;
+    std::size_t n_features_;
+};
+
+
+// Dataset served from a memory-mapped binary file (see save_binary()).
+// Opening it costs one mmap and a header check, pages are read on demand.
+class MappedDataset {
+public:
+    explicit MappedDataset(const std::string& filename);
+    ~MappedDataset();
+
+    MappedDataset(const MappedDataset&) = delete;
+    auto operator=(const MappedDataset&) -> MappedDataset& = delete;
+
+    MappedDataset(MappedDataset&& other) noexcept;
+    auto operator=(MappedDataset&& other) noexcept -> MappedDataset&;
+
+    auto size() const -> std::size_t { return view_.size(); }
+
+    // Views into the mapping, so not from a temporary that unmaps it
+    auto view() const& -> DatasetView { return view_; }
+    auto view() const&& -> DatasetView = delete;
+    operator DatasetView() const& { return view_; }
+    operator DatasetView() const&& = delete;
+
+private:
+    auto unmap() -> void;
+
+    void* base_;
+    std::size_t size_;
+    DatasetView view_;
+};
+
+
+// Consecutive minibatches of a view, the last one may be smaller. Batches
+// are subviews, so iterating copies nothing.
+//
+//   for (auto batch: Minibatches(ds, 32)) { ... }
+class Minibatches {
+public:
+    Minibatches(DatasetView data, std::size_t batch_size);
+
+    class Iterator {
+    public:
+        auto operator*() const -> DatasetView;
+        auto operator++() -> Iterator& { begin_ += batch_size_; return *this; }
+        auto operator==(const Iterator& other) const -> bool { return begin_ >= other.begin_; }
+
+    private:
+        friend class Minibatches;
+        Iterator(DatasetView data, std::size_t batch_size, std::size_t begin):
+            data_{ data }, batch_size_{ batch_size }, begin_{ begin } {}
+
+        DatasetView data_;
+        std::size_t batch_size_;
+        std::size_t begin_;
+    };
+
+    auto begin() const -> Iterator { return { data_, batch_size_, 0 }; }
+    auto end() const -> Iterator { return { data_, batch_size_, data_.size() }; }
+
+    auto size() const -> std::size_t { return (data_.size() + batch_size_ - 1) / batch_size_; }
+
+private:
+    DatasetView data_;
+    std::size_t batch_size_;
+};
+
+
+// Minibatch produced by a DataLoader, its samples copied out of the dataset
+// into a layout the model takes directly, in the loader's precision
+template <typename T>
+struct BasicBatch {
+    BasicTensor<T> x;       // features, one sample per row
+    std::vector<T> y;       // labels
+
+    auto size() const -> std::size_t { return y.size(); }
+    auto view() const -> DatasetView requires std::same_as<T, double> { return { x.data, y, x.cols() }; }
+};
+
+using Batch = BasicBatch<double>;
+
+struct DataLoaderOptions {
+    bool shuffle = true;
+    bool drop_last = false;     // skip the last batch of an epoch if it is short
+    std::size_t prefetch = 2;   // batches prepared ahead, 2 = double buffering
+    std::uint64_t seed = 42;
+};
+
+// Produces minibatches on a background thread: every epoch it shuffles the
+// sample order, gathers each batch into a BasicBatch<T> and pushes it into a
+// bounded queue, so the next batch is ready when a training step finishes.
+// With T = float the samples are converted while they are gathered, ready
+// for the float path of MLP. The dataset behind data must outlive the loader.
+//
+//   auto loader = DataLoader(ds, 32);
+//   for (std::size_t epoch = 0; epoch < n_epochs; ++epoch) {
+//       while (auto batch = loader.next()) { ... }
+//   }
+template <typename T>
+class BasicDataLoader {
+public:
+    BasicDataLoader(DatasetView data, std::size_t batch_size, DataLoaderOptions options = {});
+    ~BasicDataLoader();
+
+    BasicDataLoader(const BasicDataLoader&) = delete;
+    auto operator=(const BasicDataLoader&) -> BasicDataLoader& = delete;
+
+    // Next batch of the current epoch, blocking until it is ready. Returns
+    // nullopt once at the end of every epoch; the call after that starts the
+    // next one. Errors of the background thread are rethrown here.
+    auto next() -> std::optional<BasicBatch<T>>;
+
+    auto batches_per_epoch() const -> std::size_t;
+
+private:
+    auto worker_loop() -> void;
+    auto push(std::optional<BasicBatch<T>> batch) -> bool;
+
+    DatasetView data_;
+    std::size_t batch_size_;
+    DataLoaderOptions options_;
+
+    std::mutex mutex_;
+    std::condition_variable not_full_;
+    std::condition_variable not_empty_;
+    std::deque<std::optional<BasicBatch<T>>> queue_;  // nullopt marks the end of an epoch
+    std::exception_ptr error_;
+    bool stop_;
+    std::thread worker_;
+};
+
+using DataLoader = BasicDataLoader<double>;
+using FloatDataLoader = BasicDataLoader<float>;
+
+
+// Reads a CSV file of numbers one record at a time, without buffering the
+// file. A first line that does not parse as numbers is taken as a header.
+class CsvReader {
+public:
+    explicit CsvReader(const std::string& filename);
+
+    // Fields of the next record; false at the end of the file
+    auto next(std::vector<double>& fields) -> bool;
+
+    auto header() const -> const std::vector<std::string>& { return header_; }
+
+private:
+    auto parse(const std::string& line, std::vector<double>& fields) const -> bool;
+
+    std::ifstream file_;
+    std::string filename_;
+    std::string line_;
+    std::vector<std::string> header_;
+    std::size_t line_number_;
+    bool pending_;  // line_ holds a record read while looking for the header
+};
+
+// Whole CSV file as a Dataset, the last column is the label
+auto read_csv(const std::string& filename) -> Dataset;
+
+// Header "x0,x1,...,label" (or "x,y,label" for two features), one row per sample
+auto save_csv(DatasetView data, const std::string& filename) -> void;
+
+// Binary format for MappedDataset, all fields little-endian:
+//   char[8] magic "MGRDDSET", u32 version, u32 reserved,
+//   u64 n_samples, u64 n_features, f64 features[n_samples * n_features],
+//   f64 labels[n_samples]
+auto save_binary(DatasetView data, const std::string& filename) -> void;
+
+
+// Leaf Values for one sample, to feed the graph-building forward pass. They
+// live on the active GraphArena, if any.
+[[nodiscard]] auto to_values(std::span<const double> x) -> std::vector<ValuePtr>;
+[[nodiscard]] auto to_values(DatasetView data) -> std::vector<std::vector<ValuePtr>>;
+
+// Features as a batch for MLP::forward / predict, one sample per row, in
+// double or float precision
+template <typename T = double>
+[[nodiscard]] auto to_tensor(DatasetView data) -> BasicTensor<T>;
+
+
+} // namespace micrograd
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <cmath>
+#include <format>
+#include <iostream>
+#include <span>
+#include <stdexcept>
+#include <vector>
+
+
+namespace micrograd {
+
+
+// Forward-mode AD scalar: a value and its derivative along one direction
+// (the tangent). Evaluating a function on Duals yields the function value
+// and its Jacobian-vector product in the same pass, without a graph; use it
+// instead of backward() when there are fewer inputs than outputs, e.g. the
+// sensitivity of an MLP score to each of its features.
+//
+//   auto x = seed(features, direction);
+//   auto out = model.predict(x);   // out[i].tangent = J(features) * direction
+struct Dual {
+    double value = 0.0;
+    double tangent = 0.0;
+
+    auto operator+=(Dual other) -> Dual& { value += other.value; tangent += other.tangent; return *this; }
+    auto operator-=(Dual other) -> Dual& { value -= other.value; tangent -= other.tangent; return *this; }
+
+    friend auto operator<<(std::ostream& stream, Dual d) -> std::ostream& {
+        stream << std::format("Dual({}, {})", d.value, d.tangent);
+        return stream;
+    }
+};
+
+
+inline auto operator+(Dual a, Dual b) -> Dual { return { a.value + b.value, a.tangent + b.tangent }; }
+inline auto operator+(double a, Dual b) -> Dual { return { a + b.value, b.tangent }; }
+inline auto operator+(Dual a, double b) -> Dual { return { a.value + b, a.tangent }; }
+
+inline auto operator-(Dual a, Dual b) -> Dual { return { a.value - b.value, a.tangent - b.tangent }; }
+inline auto operator-(double a, Dual b) -> Dual { return { a - b.value, -b.tangent }; }
+inline auto operator-(Dual a, double b) -> Dual { return { a.value - b, a.tangent }; }
+
+inline auto operator*(Dual a, Dual b) -> Dual { return { a.value * b.value, a.tangent * b.value + a.value * b.tangent }; }
+inline auto operator*(double a, Dual b) -> Dual { return { a * b.value, a * b.tangent }; }
+inline auto operator*(Dual a, double b) -> Dual { return { a.value * b, a.tangent * b }; }
+
+inline auto operator/(Dual a, Dual b) -> Dual {
+    auto q = a.value / b.value;
+    return { q, (a.tangent - q * b.tangent) / b.value };
+}
+inline auto operator/(double a, Dual b) -> Dual {
+    auto q = a / b.value;
+    return { q, -q / b.value * b.tangent };
+}
+inline auto operator/(Dual a, double b) -> Dual { return { a.value / b, a.tangent / b }; }
+
+inline auto operator-(Dual a) -> Dual { return { -a.value, -a.tangent }; }
+
+
+inline auto pow(Dual base, double exp) -> Dual {
+    return { std::pow(base.value, exp), exp * std::pow(base.value, exp - 1) * base.tangent };
+}
+
+inline auto pow(Dual base, Dual exp) -> Dual {
+    auto v = std::pow(base.value, exp.value);
+    auto t = exp.value * std::pow(base.value, exp.value - 1) * base.tangent;
+    // The log term only exists if the exponent moves, negative bases are fine otherwise
+    if (exp.tangent != 0.0) t += v * std::log(base.value) * exp.tangent;
+
+    return { v, t };
+}
+
+inline auto exp(Dual a) -> Dual {
+    auto v = std::exp(a.value);
+    return { v, v * a.tangent };
+}
+
+inline auto tanh(Dual a) -> Dual {
+    auto t = std::tanh(a.value);
+    return { t, (1 - t * t) * a.tangent };
+}
+
+inline auto relu(Dual a) -> Dual {
+    return a.value > 0.0 ? a : Dual{ 0.0, 0.0 };
+}
+
+
+// Inputs x moving along direction v
+[[nodiscard]] inline auto seed(std::span<const double> x, std::span<const double> v) -> std::vector<Dual> {
+    if (x.size() != v.size()) {
+        throw std::invalid_argument(
+            std::format("seed: point and direction need to be the same size ({} vs {})!", x.size(), v.size())
+        );
+    }
+
+    auto duals = std::vector<Dual>(x.size());
+    for (std::size_t i = 0; i < x.size(); ++i) duals[i] = { x[i], v[i] };
+
+    return duals;
+}
+
+
+} // namespace micrograd
@@ -1,103 +1,633 @@
 #include "engine.h"
 
 #include <cmath>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <new>
+#include <stdexcept>
+
+#include "profile.h"
 
 
 namespace micrograd {
 
 
-auto Value::print_graph(std::size_t depth) const -> void {
-    std::string indent(depth * 4, ' ');
-    std::cout << indent << std::format("Value({:.2f}) op='{}' grad='{:.2f}'\n", data, op, grad);
-    for (const auto& child: children) {
-        child->print_graph(depth + 1);
-    }
+namespace {
+
+thread_local GraphArena* current_arena = nullptr;
+
+// Traversal epochs are unique across threads; 0 marks "never visited"
+std::atomic<std::uint32_t> traversal_epoch{ 0 };
+
+auto next_epoch() -> std::uint32_t {
+    auto epoch = ++traversal_epoch;
+    return epoch != 0 ? epoch : ++traversal_epoch;
 }
 
+// Buffers of the topological sort, reused across backward() calls
+thread_local std::vector<Value*> topo;
+thread_local std::vector<std::pair<Value*, std::size_t>> dfs_stack;
+
+// Owning handles to the nodes in topo, filled by build_topo on request
+thread_local std::vector<ValuePtr> topo_owned;
+
+// Iterative post-order DFS: fills topo with every node reachable from root,
+// children before their parents. With grad_only = true operands without
+// requires_grad are not entered. With own = true topo_owned[i] additionally
+// holds a reference to topo[i]. Throws if the walk reaches a released node.
+auto build_topo(const ValuePtr& root, bool grad_only = false, bool own = false) -> void {
+    auto epoch = next_epoch();
+
+    auto check = [](const Value& v) {
+        if (v.op == Op::released) {
+            throw std::logic_error(
+                "graph was released by an earlier backward(), pass retain_graph to run over it again!"
+            );
+        }
+    };
 
-auto backward(const ValuePtr& root) -> void {
-    std::vector<ValuePtr> topo;
-    std::unordered_set<Value*> visited;
+    topo.clear();
+    topo_owned.clear();
+    dfs_stack.clear();
 
-    auto build_topo = [&](auto&& self, ValuePtr v) -> void {
-        if (visited.find(v.get()) == visited.end()) {
-            visited.insert(v.get());
-            for (const auto& child : v->children) {
-                self(self, child);
-            }
+    check(*root);
+    root->mark = epoch;
+    dfs_stack.emplace_back(root.get(), 0);
+
+    while (!dfs_stack.empty()) {
+        auto& [v, next] = dfs_stack.back();
+
+        if (next == v->slot_count()) {
             topo.push_back(v);
+            dfs_stack.pop_back();
+            if (own) {
+                // v's handle is the slot of the parent that discovered it
+                if (dfs_stack.empty()) {
+                    topo_owned.push_back(root);
+                } else {
+                    const auto& [parent, slot] = dfs_stack.back();
+                    topo_owned.push_back(parent->slot(slot - 1));
+                }
+            }
+            continue;
         }
-    };
 
-    build_topo(build_topo, root);
+        auto* child = v->slot(next++).get();
+        if (child != nullptr && child->mark != epoch && (child->requires_grad || !grad_only)) {
+            check(*child);
+            child->mark = epoch;
+            dfs_stack.emplace_back(child, 0);
+        }
+    }
+}
 
-    root->grad = 1.0;
-    std::ranges::reverse(topo);
-    for (const auto& v: topo) {
-        v->backward();
+// Create a node on the active arena, or on the heap if no arena is active
+auto make_node(
+    double data,
+    Op op,
+    const ValuePtr& left = nullptr,
+    const ValuePtr& right = nullptr,
+    double saved = 0.0
+) -> ValuePtr {
+#ifdef MICROGRAD_PROFILE
+    profile::detail::record_node(op, sizeof(Value));
+#endif
+
+    if (current_arena == nullptr) {
+        return std::make_shared<Value>(data, op, left, right, saved);
     }
+
+    return std::allocate_shared<Value>(
+        std::pmr::polymorphic_allocator<Value>{ current_arena },
+        data, op, left, right, saved
+    );
 }
 
+// Create an n-ary node, its operand list lives on the same arena
+template<typename... Spans>
+auto make_nary_node(double data, Op op, Spans... spans) -> ValuePtr {
+    auto* resource = current_arena != nullptr
+        ? static_cast<std::pmr::memory_resource*>(current_arena)
+        : std::pmr::get_default_resource();
 
-auto operator+(const ValuePtr& left, const ValuePtr& right) -> ValuePtr {
-    auto out = std::make_shared<Value>(
-        left->data + right->data,
-        std::vector{ left, right },
-        "+"
+    auto operands = Operands{ resource, { std::span<const ValuePtr>{ spans }... } };
+
+#ifdef MICROGRAD_PROFILE
+    profile::detail::record_node(op, sizeof(Value) + operands.size() * sizeof(ValuePtr));
+#endif
+
+    if (current_arena == nullptr) {
+        return std::make_shared<Value>(data, op, std::move(operands));
+    }
+
+    return std::allocate_shared<Value>(
+        std::pmr::polymorphic_allocator<Value>{ current_arena },
+        data, op, std::move(operands)
     );
+}
 
-    // Use raw pointer here since capturing smart pointer creates cycle
-    // Safe, since lambda lives in object out which is thus guaranteed
-    // to be alive when out->backward() is called.
-    auto const* out_ptr = out.get();
-    out->backward = [left, right, out_ptr]() {
-        left->grad += out_ptr->grad;
-        right->grad += out_ptr->grad;
-    };
+// Gradient accumulation policies of propagate(). Operands without
+// requires_grad are skipped, nobody reads their gradient.
+struct PlainAdd {
+    auto operator()(const ValuePtr& x, double d) const -> void {
+        if (x->requires_grad) x->grad += d;
+    }
+};
 
-    return out;
+struct AtomicAdd {
+    auto operator()(const ValuePtr& x, double d) const -> void {
+        if (x->requires_grad) std::atomic_ref<double>{ x->grad }.fetch_add(d, std::memory_order_relaxed);
+    }
+};
+
+// Local derivative rule of v: accumulate v.grad into the gradients of its operands
+template<typename Add>
+inline auto propagate(const Value& v, Add add) -> void {
+    const auto& a = v.children[0];
+    const auto& b = v.children[1];
+    auto g = v.grad;
+
+    switch (v.op) {
+    case Op::leaf:
+    case Op::released:
+        break;
+    case Op::add:
+        add(a, g);
+        add(b, g);
+        break;
+    case Op::add_const:
+        add(a, g);
+        break;
+    case Op::sub:
+        add(a, g);
+        add(b, -g);
+        break;
+    case Op::rsub_const:
+    case Op::neg:
+        add(a, -g);
+        break;
+    case Op::mul:
+        add(a, b->data * g);
+        add(b, a->data * g);
+        break;
+    case Op::mul_const:
+        add(a, v.saved * g);
+        break;
+    case Op::div:
+        add(a, g / b->data);
+        add(b, -v.data / b->data * g);
+        break;
+    case Op::rdiv_const:
+        add(a, -v.data / a->data * g);
+        break;
+    case Op::pow:
+        add(a, (b->data * std::pow(a->data, b->data - 1)) * g);
+        add(b, (v.data * std::log(a->data)) * g);
+        break;
+    case Op::pow_const:
+        add(a, (v.saved * std::pow(a->data, v.saved - 1)) * g);
+        break;
+    case Op::exp:
+        add(a, v.data * g);
+        break;
+    case Op::tanh:
+        add(a, (1 - v.data * v.data) * g);
+        break;
+    case Op::relu:
+        add(a, (v.data > 0 ? 1.0 : 0.0) * g);
+        break;
+    case Op::fused:
+        add(a, v.saved * g);
+        break;
+    case Op::dot: {
+        // operands = [w_0 .. w_n-1, x_0 .. x_n-1]
+        auto n = v.operands.size() / 2;
+        const auto* ws = v.operands.data();
+        const auto* xs = ws + n;
+        for (std::size_t i = 0; i < n; ++i) {
+            add(ws[i], xs[i]->data * g);
+            add(xs[i], ws[i]->data * g);
+        }
+        break;
+    }
+    case Op::sum:
+        for (const auto& operand: v.operands) {
+            add(operand, g);
+        }
+        break;
+    }
 }
 
-// Addition overload for constant left parameter
-auto operator+(double left, const ValuePtr& right) -> ValuePtr {
-    auto out = std::make_shared<Value>(
-        left + right->data,
-        std::vector{ right },
-        "+" //std::format("+ {:.2f}", left) // add constant to operation string so that it is visible in computational graph
+// propagate(), counted per op when profiling and timed for a sample
+template<typename Add>
+inline auto apply_rule(const Value& v, Add add) -> void {
+#ifdef MICROGRAD_PROFILE
+    if (!profile::detail::sample_backward(v.op)) {
+        propagate(v, add);
+        return;
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    propagate(v, add);
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    profile::detail::record_backward(
+        v.op, static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count())
     );
+#else
+    propagate(v, add);
+#endif
+}
+
+} // namespace
+
+
+//
+// GraphArena
+//
+
+GraphArena::GraphArena(std::size_t initial_size):
+    capacity_{ std::max<std::size_t>(initial_size, 1024) },
+    buffer_{ std::make_unique<std::byte[]>(capacity_) },
+    resource_{},
+    used_{ 0 },
+    live_{ 0 }
+{
+    resource_.emplace(buffer_.get(), capacity_);
+}
+
+auto GraphArena::reset() -> void {
+    if (live_ != 0) {
+        throw std::logic_error(
+            std::format("GraphArena::reset: {} allocations are still alive!", live_)
+        );
+    }
+
+    // Overflowed into upstream chunks: grow the buffer so that the next
+    // graph of the same size fits into one block
+    if (used_ > capacity_) {
+        capacity_ = std::bit_ceil(used_);
+        buffer_ = std::make_unique<std::byte[]>(capacity_);
+    }
+
+#ifdef MICROGRAD_PROFILE
+    profile::detail::record_arena(used_);
+#endif
+
+    resource_.emplace(buffer_.get(), capacity_);
+    used_ = 0;
+}
+
+auto GraphArena::current() -> GraphArena* {
+    return current_arena;
+}
+
+auto GraphArena::do_allocate(std::size_t bytes, std::size_t alignment) -> void* {
+    auto* p = resource_->allocate(bytes, alignment);
+    used_ += bytes;
+    ++live_;
+    return p;
+}
+
+auto GraphArena::do_deallocate(void*, std::size_t, std::size_t) -> void {
+    // Memory is only reclaimed in bulk by reset()
+    --live_;
+}
+
+auto GraphArena::do_is_equal(const std::pmr::memory_resource& other) const noexcept -> bool {
+    return this == &other;
+}
+
+GraphArena::Scope::Scope(GraphArena& arena): previous_{ current_arena } {
+    current_arena = &arena;
+}
+
+GraphArena::Scope::~Scope() {
+    current_arena = previous_;
+}
+
+
+//
+// Operands
+//
+
+Operands::Operands(std::pmr::memory_resource* resource, std::initializer_list<std::span<const ValuePtr>> parts):
+    block_{ nullptr }
+{
+    std::size_t n = 0;
+    for (const auto& part: parts) n += part.size();
+    if (n == 0) return;
+
+    auto* p = resource->allocate(sizeof(Block) + n * sizeof(ValuePtr), alignof(Block));
+    block_ = ::new (p) Block{ resource, n };
+
+    auto* out = data();
+    for (const auto& part: parts) out = std::uninitialized_copy(part.begin(), part.end(), out);
+}
+
+Operands::Operands(const Operands& other):
+    Operands(other.block_ != nullptr ? other.block_->resource : nullptr, { std::span<const ValuePtr>{ other.begin(), other.end() } })
+{}
+
+auto Operands::operator=(const Operands& other) -> Operands& {
+    if (this != &other) *this = Operands{ other };
+    return *this;
+}
+
+auto Operands::operator=(Operands&& other) noexcept -> Operands& {
+    if (this != &other) {
+        reset();
+        block_ = std::exchange(other.block_, nullptr);
+    }
+    return *this;
+}
+
+auto Operands::reset() -> void {
+    if (block_ == nullptr) return;
+
+    // Detach first, destroying an operand may reenter through ~Value
+    auto* block = std::exchange(block_, nullptr);
+    auto* items = reinterpret_cast<ValuePtr*>(block + 1);
+    auto n = block->size;
+    auto* resource = block->resource;
+
+    std::destroy_n(items, n);
+    block->~Block();
+    resource->deallocate(block, sizeof(Block) + n * sizeof(ValuePtr), alignof(Block));
+}
+
 
-    auto const* out_ptr = out.get();
-    out->backward = [right, out_ptr]() {
-        right->grad += out_ptr->grad;
+//
+// Value
+//
+
+
+auto to_string(Op op) -> std::string_view {
+    switch (op) {
+    case Op::leaf:       return "";
+    case Op::add:        return "+";
+    case Op::add_const:  return "+";
+    case Op::sub:        return "-";
+    case Op::rsub_const: return "-";
+    case Op::neg:        return "-";
+    case Op::mul:        return "*";
+    case Op::mul_const:  return "*";
+    case Op::div:        return "/";
+    case Op::rdiv_const: return "/";
+    case Op::pow:        return "pow";
+    case Op::pow_const:  return "pow";
+    case Op::exp:        return "exp";
+    case Op::tanh:       return "tanh";
+    case Op::relu:       return "relu";
+    case Op::fused:      return "fused";
+    case Op::released:   return "released";
+    case Op::dot:        return "dot";
+    case Op::sum:        return "sum";
+    }
+    return "?";
+}
+
+
+Value::~Value() {
+    // Operands owned by this node alone would be destroyed recursively, one
+    // stack frame per node. Instead they are moved onto a pending list that
+    // the outermost destructor drains; the nodes destroyed while draining
+    // only append their own operands.
+    thread_local std::vector<ValuePtr> pending;
+    thread_local bool draining = false;
+
+    auto detach = [](ValuePtr& p) {
+        if (p && p.use_count() == 1) pending.push_back(std::move(p));
     };
+    for (auto& child: children) detach(child);
+    for (auto& operand: operands) detach(operand);
+
+    if (draining) return;
 
-    return out;
+    draining = true;
+    while (!pending.empty()) {
+        auto v = std::move(pending.back());
+        pending.pop_back();
+    }
+    draining = false;
 }
 
-// Addition overload for constant right parameter
-auto operator+(const ValuePtr& left, double right) -> ValuePtr {
-    auto out = std::make_shared<Value>(
-        left->data + right,
-        std::vector{ left },
-        "+" //std::format("+ {:.2f}", right)
-    );
 
-    auto const* out_ptr = out.get();
-    out->backward = [left, out_ptr]() {
-        left->grad += out_ptr->grad;
+auto Value::print_graph(std::size_t depth) const -> void {
+    // Pre-order walk with an explicit stack, children in slot order
+    auto stack = std::vector<std::pair<const Value*, std::size_t>>{ { this, depth } };
+
+    while (!stack.empty()) {
+        auto [v, d] = stack.back();
+        stack.pop_back();
+
+        std::string indent(d * 4, ' ');
+        std::cout << indent << std::format("Value({:.2f}) op='{}' grad='{:.2f}'\n", v->data, to_string(v->op), v->grad);
+
+        for (auto i = v->slot_count(); i-- > 0;) {
+            if (const auto& child = v->slot(i)) stack.emplace_back(child.get(), d + 1);
+        }
+    }
+}
+
+
+auto backward_step(const Value& v, bool atomic) -> void {
+    if (atomic) {
+        apply_rule(v, AtomicAdd{});
+    } else {
+        apply_rule(v, PlainAdd{});
+    }
+}
+
+
+auto topological_sort(const ValuePtr& root, bool grad_only) -> const std::vector<Value*>& {
+    build_topo(root, grad_only);
+    return topo;
+}
+
+
+auto backward(const ValuePtr& root, BackwardOptions options) -> void {
+    if (options.simplify) simplify(root);
+
+    if (options.retain_graph) {
+        build_topo(root, true);
+
+        root->grad = 1.0;
+        for (auto it = topo.rbegin(); it != topo.rend(); ++it) {
+            apply_rule(**it, PlainAdd{});
+        }
+#ifdef MICROGRAD_PROFILE
+        profile::detail::flush();
+#endif
+        return;
+    }
+
+    build_topo(root, true, true);
+
+    // Parents come first, so once v's rule has run nothing reads v again:
+    // release it and drop our handle, which frees v unless someone else
+    // still holds it. topo_owned keeps the operands alive until their turn.
+    // Leaves stay leaves, so parameters can take part in the next graph.
+    root->grad = 1.0;
+    for (auto i = topo.size(); i-- > 0;) {
+        auto& v = *topo[i];
+        apply_rule(v, PlainAdd{});
+
+        if (v.op != Op::leaf) {
+            v.op = Op::released;
+            v.saved = 0.0;
+            v.children = {};
+            v.operands.reset();
+        }
+        topo_owned[i] = nullptr;
+    }
+
+#ifdef MICROGRAD_PROFILE
+    profile::detail::flush();
+#endif
+}
+
+
+//
+// Graph simplification
+//
+
+namespace {
+
+// Operand that v passes on unchanged, nullptr unless v is an identity op
+auto identity_operand(const Value& v) -> const ValuePtr* {
+    const auto& a = v.children[0];
+
+    switch (v.op) {
+    case Op::add_const:
+        return v.saved == 0.0 ? &a : nullptr;
+    case Op::mul_const:
+    case Op::pow_const:
+        return v.saved == 1.0 ? &a : nullptr;
+    case Op::neg:
+        return a->op == Op::neg ? &a->children[0] : nullptr;
+    default:
+        return nullptr;
+    }
+}
+
+// Fuse the unary constant op v with its operand a, itself a unary constant
+// op used by v alone: v takes over a's operand and the combined constant.
+// Returns false if the pair has no fused form.
+auto fuse(Value& v) -> bool {
+    const auto& a = v.children[0];
+    if (!a || v.children[1] || a->level != 1) return false;
+
+    auto c = v.saved;
+    auto d = a->saved;
+    auto rewrite = [&](Op op, double saved) {
+        v.op = op;
+        v.saved = saved;
+        v.children[0] = ValuePtr(a->children[0]);
+        return true;
+    };
+
+    switch (v.op) {
+    case Op::add_const:
+        if (a->op == Op::add_const) return rewrite(Op::add_const, c + d);      // (x + d) + c
+        if (a->op == Op::rsub_const) return rewrite(Op::rsub_const, c + d);    // (d - x) + c
+        if (a->op == Op::neg) return rewrite(Op::rsub_const, c);               // (-x) + c
+        break;
+    case Op::rsub_const:
+        if (a->op == Op::add_const) return rewrite(Op::rsub_const, c - d);     // c - (x + d)
+        if (a->op == Op::rsub_const) return rewrite(Op::add_const, c - d);     // c - (d - x)
+        if (a->op == Op::neg) return rewrite(Op::add_const, c);                // c - (-x)
+        break;
+    case Op::neg:
+        if (a->op == Op::add_const) return rewrite(Op::rsub_const, -d);        // -(x + d)
+        if (a->op == Op::rsub_const) return rewrite(Op::add_const, -d);        // -(d - x)
+        if (a->op == Op::mul_const) return rewrite(Op::mul_const, -d);         // -(x * d)
+        if (a->op == Op::rdiv_const) return rewrite(Op::rdiv_const, -d);       // -(d / x)
+        break;
+    case Op::mul_const:
+        if (a->op == Op::mul_const) return rewrite(Op::mul_const, c * d);      // (x * d) * c
+        if (a->op == Op::rdiv_const) return rewrite(Op::rdiv_const, c * d);    // (d / x) * c
+        if (a->op == Op::neg) return rewrite(Op::mul_const, -c);               // (-x) * c
+        break;
+    case Op::rdiv_const:
+        if (a->op == Op::mul_const) return rewrite(Op::rdiv_const, c / d);     // c / (x * d)
+        if (a->op == Op::neg) return rewrite(Op::rdiv_const, -c);              // c / (-x)
+        break;
+    default:
+        break;
+    }
+
+    return false;
+}
+
+} // namespace
+
+auto simplify(const ValuePtr& root) -> void {
+    build_topo(root);
+
+    // Uses of every node within the graph, kept in the scheduler scratch
+    // field. Bypassing a node does not decrement its count, so counts may
+    // overestimate, which at worst skips a fusion.
+    for (auto* v: topo) v->level = 0;
+    for (const auto* v: topo) {
+        for (std::size_t i = 0; i < v->slot_count(); ++i) {
+            if (const auto& child = v->slot(i)) ++child->level;
+        }
+    }
+
+    auto bypass = [](ValuePtr& slot) {
+        while (slot) {
+            const auto* target = identity_operand(*slot);
+            if (target == nullptr) break;
+
+            ++(*target)->level;
+            slot = ValuePtr(*target);
+        }
     };
 
-    return out;
+    // Children first, so the operands of v are final when v is rewritten.
+    // Nodes dropped by a rewrite come before v in topo and are not visited
+    // again.
+    for (auto* v: topo) {
+        for (auto& child: v->children) bypass(child);
+        for (auto& operand: v->operands) bypass(operand);
+
+        while (fuse(*v)) {}
+    }
+}
+
+
+auto leaf(double data) -> ValuePtr {
+    return make_node(data, Op::leaf);
+}
+
+auto fused_node(double data, double derivative, const ValuePtr& x) -> ValuePtr {
+    return make_node(data, Op::fused, x, nullptr, derivative);
+}
+
+
+auto operator+(const ValuePtr& left, const ValuePtr& right) -> ValuePtr {
+    return make_node(left->data + right->data, Op::add, left, right);
+}
+
+// Addition overload for constant left parameter
+auto operator+(double left, const ValuePtr& right) -> ValuePtr {
+    return make_node(left + right->data, Op::add_const, right, nullptr, left);
+}
+
+// Addition overload for constant right parameter
+auto operator+(const ValuePtr& left, double right) -> ValuePtr {
+    return make_node(left->data + right, Op::add_const, left, nullptr, right);
 }
 
 
 auto operator-(const ValuePtr& left, const ValuePtr& right) -> ValuePtr {
-    return left + (right * -1.0);
+    return make_node(left->data - right->data, Op::sub, left, right);
 }
 
 // Subtraction overload for constant left parameter
 auto operator-(double left, const ValuePtr& right) -> ValuePtr {
-    return left + (right * -1.0);
+    return make_node(left - right->data, Op::rsub_const, right, nullptr, left);
 }
 
 // Subtraction overload for constant right parameter
@@ -107,60 +637,26 @@ auto operator-(const ValuePtr& left, double right) -> ValuePtr {
 
 
 auto operator*(const ValuePtr& left, const ValuePtr& right) -> ValuePtr {
-    auto out = std::make_shared<Value>(
-        left->data * right->data,
-        std::vector{ left, right },
-        "*"
-    );
-
-    auto const* out_ptr = out.get();
-    out->backward = [left, right, out_ptr]() {
-        left->grad += right->data * out_ptr->grad;
-        right->grad += left->data * out_ptr->grad;
-    };
-
-    return out;
+    return make_node(left->data * right->data, Op::mul, left, right);
 }
 
 // Multiplication overload for constant left parameter
 auto operator*(double left, const ValuePtr& right) -> ValuePtr {
-    auto out = std::make_shared<Value>(
-        left * right->data,
-        std::vector{ right },
-        "*" // std::format("* {:.2f}", left)
-    );
-
-    auto const* out_ptr = out.get();
-    out->backward = [left, right, out_ptr]() {
-        right->grad += left * out_ptr->grad;
-    };
-
-    return out;
+    return make_node(left * right->data, Op::mul_const, right, nullptr, left);
 }
 
 // Multiplication overload for constant right parameter
 auto operator*(const ValuePtr& left, double right) -> ValuePtr {
-    auto out = std::make_shared<Value>(
-        left->data * right,
-        std::vector{ left },
-        "*" // std::format("* {:.2f}", right)
-    );
-
-    auto const* out_ptr = out.get();
-    out->backward = [left, right, out_ptr]() {
-        left->grad += right * out_ptr->grad;
-    };
-
-    return out;
+    return make_node(left->data * right, Op::mul_const, left, nullptr, right);
 }
 
 auto operator/(const ValuePtr& left, const ValuePtr& right) -> ValuePtr {
-    return left * pow(right, std::make_shared<Value>(-1.0));
+    return make_node(left->data / right->data, Op::div, left, right);
 }
 
 // Division overload for constant left parameter
 auto operator/(double left, const ValuePtr& right) -> ValuePtr {
-    return left * pow(right, std::make_shared<Value>(-1.0));
+    return make_node(left / right->data, Op::rdiv_const, right, nullptr, left);
 }
 
 // Division overload for constant right parameter
@@ -169,100 +665,62 @@ auto operator/(const ValuePtr& left, double right) -> ValuePtr {
 }
 
 auto operator-(const ValuePtr& v) -> ValuePtr {
-    return -1.0 * v;
+    return make_node(-v->data, Op::neg, v);
 }
 
 
 auto pow(const ValuePtr& base, const ValuePtr& exp) -> ValuePtr {
     // x**y
-    auto x = base->data;
-    auto y = exp->data;
-
-    auto out = std::make_shared<Value>(
-        std::pow(x, y),
-        std::vector{ base, exp },
-        "pow"
-    );
-
-    auto const* out_ptr = out.get();
-    out->backward = [base, exp, x, y, out_ptr]() {
-        base->grad += (y * std::pow(x, y - 1)) * out_ptr->grad;
-        exp->grad += (out_ptr->data * std::log(x)) * out_ptr->grad;
-    };   
-    
-    return out;
+    return make_node(std::pow(base->data, exp->data), Op::pow, base, exp);
 }
 
 // Pow overload with constant exponent
 auto pow(const ValuePtr& base, double exp) -> ValuePtr {
-    // x**y
-    auto x = base->data;
-
-    auto out = std::make_shared<Value>(
-        std::pow(x, exp),
-        std::vector{ base },
-        "pow" // std::format("pow (exp: {:.2f})", exp)
-    );
-
-    auto const* out_ptr = out.get();
-    out->backward = [base, exp, x, out_ptr]() {
-        base->grad += (exp * std::pow(x, exp - 1)) * out_ptr->grad;
-    };   
-    
-    return out;
+    return make_node(std::pow(base->data, exp), Op::pow_const, base, nullptr, exp);
 }
 
 
 auto exp(const ValuePtr& v) -> ValuePtr {
-    auto x = v->data;
-
-    auto out = std::make_shared<Value>(
-        std::exp(x),
-        std::vector{ v },
-        "exp"
-    );
-
-    auto const* out_ptr = out.get();
-    out->backward = [v, out_ptr]() {
-        v->grad += out_ptr->data * out_ptr->grad;
-    };   
-    
-    return out;
+    return make_node(std::exp(v->data), Op::exp, v);
 }
 
 
 auto tanh(const ValuePtr& v) -> ValuePtr {
     auto x = v->data;
     auto t = (std::exp(2 * x) - 1) / (std::exp(2 * x) + 1);
-    
-    auto out = std::make_shared<Value>(
-        t,
-        std::vector{ v },
-        "tanh"
-    );
-
-    auto const* out_ptr = out.get();
-    out->backward = [v, t, out_ptr]() {
-        v->grad += (1 - t * t) * out_ptr->grad;
-    };    
 
-    return out;
+    return make_node(t, Op::tanh, v);
 }
 
 
 auto relu(const ValuePtr& v) -> ValuePtr {
-    auto out = std::make_shared<Value>(
-        v->data < 0.0 ? 0.0 : v->data,
-        std::vector{ v },
-        "relu"
-    );
+    return make_node(v->data < 0.0 ? 0.0 : v->data, Op::relu, v);
+}
 
-    auto const* out_ptr = out.get();
-    out->backward = [v, out_ptr]() {
-        v->grad += (out_ptr->data > 0 ? 1.0 : 0.0) * out_ptr->grad;
-    };
 
-    return out;
+auto dot(std::span<const ValuePtr> ws, std::span<const ValuePtr> xs) -> ValuePtr {
+    if (ws.size() != xs.size()) {
+        throw std::invalid_argument(
+            std::format("dot: operands need to be the same size ({} vs {})!", ws.size(), xs.size())
+        );
+    }
+
+    double acc = 0.0;
+    for (std::size_t i = 0; i < ws.size(); ++i) {
+        acc += ws[i]->data * xs[i]->data;
+    }
+
+    return make_nary_node(acc, Op::dot, ws, xs);
+}
+
+
+auto sum(std::span<const ValuePtr> values) -> ValuePtr {
+    double acc = 0.0;
+    for (const auto& v: values) {
+        acc += v->data;
+    }
+
+    return make_nary_node(acc, Op::sum, values);
 }
 
 
@@ -1,13 +1,19 @@
 #pragma once
 
 #include <memory>
+#include <array>
+#include <cstdint>
+#include <memory_resource>
+#include <optional>
 #include <iostream>
 #include <vector>
 #include <string>
-#include <unordered_set>
-#include <functional>
+#include <string_view>
+#include <span>
 #include <algorithm>
 #include <format>
+#include <initializer_list>
+#include <utility>
 
 
 namespace micrograd {
@@ -17,38 +23,263 @@ class Value;
 using ValuePtr = std::shared_ptr<Value>;
 
 
+// Operation that produced a node. For the *_const variants the constant
+// operand is stored in Value::saved instead of in a leaf node; the r*_const
+// ones take it as their left operand (c - x, c / x). A fused node is a whole
+// formula of one operand (see expr.h) with its local derivative in saved.
+// The n-ary ops (dot, sum) keep their operands in Value::operands. A released
+// node had its operands dropped by backward() and cannot be walked again.
+enum class Op: std::uint8_t {
+    leaf,
+    add,
+    add_const,
+    sub,
+    rsub_const,
+    neg,
+    mul,
+    mul_const,
+    div,
+    rdiv_const,
+    pow,
+    pow_const,
+    exp,
+    tanh,
+    relu,
+    fused,
+    released,
+    dot,
+    sum
+};
+
+// Number of ops, for tables indexed by Op. Op::sum must stay the last op.
+inline constexpr std::size_t kOpCount = static_cast<std::size_t>(Op::sum) + 1;
+
+[[nodiscard]] auto to_string(Op op) -> std::string_view;
+
+
+// Operand list of an n-ary node. The list lives out of line, on the memory
+// resource the node was built on (its arena or the heap), behind a single
+// pointer, so unary and binary nodes only pay 8 bytes for it.
+class Operands {
+public:
+    Operands() = default;
+
+    // The concatenated parts, allocated from resource
+    Operands(std::pmr::memory_resource* resource, std::initializer_list<std::span<const ValuePtr>> parts);
+
+    ~Operands() { reset(); }
+
+    // Copies live on the resource of other
+    Operands(const Operands& other);
+    Operands(Operands&& other) noexcept: block_{ std::exchange(other.block_, nullptr) } {}
+    auto operator=(const Operands& other) -> Operands&;
+    auto operator=(Operands&& other) noexcept -> Operands&;
+
+    auto size() const -> std::size_t { return block_ != nullptr ? block_->size : 0; }
+    auto empty() const -> bool { return size() == 0; }
+
+    auto data() -> ValuePtr* { return block_ != nullptr ? reinterpret_cast<ValuePtr*>(block_ + 1) : nullptr; }
+    auto data() const -> const ValuePtr* { return const_cast<Operands*>(this)->data(); }
+
+    auto operator[](std::size_t i) -> ValuePtr& { return data()[i]; }
+    auto operator[](std::size_t i) const -> const ValuePtr& { return data()[i]; }
+
+    auto begin() -> ValuePtr* { return data(); }
+    auto end() -> ValuePtr* { return data() + size(); }
+    auto begin() const -> const ValuePtr* { return data(); }
+    auto end() const -> const ValuePtr* { return data() + size(); }
+
+    // Drop the operands and return the storage to its resource
+    auto reset() -> void;
+
+private:
+    // Followed by size ValuePtrs
+    struct Block {
+        std::pmr::memory_resource* resource;
+        std::size_t size;
+    };
+
+    Block* block_{ nullptr };
+};
+
+
+// A node takes part in backward() only if requires_grad is set. Leaves start
+// without it (inputs, constants), model parameters have it, and every op
+// sets it if any of its operands has it. Set it on a leaf before building
+// on it to get that leaf's gradient.
 class Value {
 public:
     double data;
     double grad;
-    std::vector<ValuePtr> children;
-    std::string op;
-    std::function<void()> backward;
+    std::array<ValuePtr, 2> children;      // operands of unary/binary ops, unused slots are empty
+    Operands operands;                     // operands of n-ary ops
+    double saved;
+    Op op;
+    bool requires_grad;   // some leaf below needs a gradient
+    std::uint32_t mark;   // epoch of the last graph traversal that visited this node
+    std::uint32_t level;  // scratch for schedulers, e.g. the parallel backward pass
 
 public:
     Value(
         double data,
-        std::vector<ValuePtr> children = {},
-        std::string op = ""
+        Op op = Op::leaf,
+        ValuePtr left = nullptr,
+        ValuePtr right = nullptr,
+        double saved = 0.0
     ):
         data{ data },
         grad{ 0.0 },
-        children{ std::move(children) },
-        op{ std::move(op) },
-        backward{ []() {} }
+        children{ std::move(left), std::move(right) },
+        operands{},
+        saved{ saved },
+        op{ op },
+        requires_grad{ std::ranges::any_of(children, needs_grad) },
+        mark{ 0 },
+        level{ 0 }
     {}
 
+    Value(double data, Op op, Operands operands):
+        data{ data },
+        grad{ 0.0 },
+        children{},
+        operands{ std::move(operands) },
+        saved{ 0.0 },
+        op{ op },
+        requires_grad{ std::ranges::any_of(this->operands, needs_grad) },
+        mark{ 0 },
+        level{ 0 }
+    {}
+
+    // Tears down the operands that only this node owns without recursing, so
+    // dropping the root of a deep chain does not overflow the stack
+    ~Value();
+
+    Value(const Value&) = default;
+    Value(Value&&) = default;
+    auto operator=(const Value&) -> Value& = default;
+    auto operator=(Value&&) -> Value& = default;
+
+    // All operand slots: the inline children first, then the n-ary operands.
+    // Slots may be empty.
+    auto slot_count() const -> std::size_t { return children.size() + operands.size(); }
+    auto slot(std::size_t i) const -> const ValuePtr& {
+        return i < children.size() ? children[i] : operands[i - children.size()];
+    }
+
     auto print_graph(std::size_t depth = 0) const -> void;
 
+    // Whether the operand in a slot takes part in backward()
+    static auto needs_grad(const ValuePtr& v) -> bool { return v && v->requires_grad; }
+
     friend auto operator<<(std::ostream& stream, const Value& value) -> std::ostream& {
-        stream << std::format("Value({}), op='{}'", value.data, value.op); 
+        stream << std::format("Value({}), op='{}'", value.data, to_string(value.op)); 
         return stream;
     }
 };
 
+// Arena for the nodes of a computational graph, typically one training step.
+// While an arena is active on a thread (see GraphArena::Scope), every node the
+// operators below create (shared_ptr control block and Value) is carved out of
+// the arena instead of the heap, and reset() frees all of them at once. Leaves
+// created with std::make_shared (e.g. model parameters) live outside the arena
+// and survive resets.
+class GraphArena: public std::pmr::memory_resource {
+public:
+    explicit GraphArena(std::size_t initial_size = 1 << 20);
+
+    GraphArena(const GraphArena&) = delete;
+    auto operator=(const GraphArena&) -> GraphArena& = delete;
+
+    // Free all nodes in bulk. Every ValuePtr into the arena must be gone by now.
+    // The buffer grows to the size of the largest graph seen so far, so steady
+    // state training steps do not touch the heap at all.
+    auto reset() -> void;
+
+    auto bytes_used() const -> std::size_t { return used_; }
+    auto capacity() const -> std::size_t { return capacity_; }
+
+    // Arena the operators allocate from on this thread (nullptr: heap)
+    static auto current() -> GraphArena*;
+
+    // Activates an arena on the current thread for the lifetime of the scope
+    class Scope {
+    public:
+        explicit Scope(GraphArena& arena);
+        ~Scope();
+
+        Scope(const Scope&) = delete;
+        auto operator=(const Scope&) -> Scope& = delete;
+
+    private:
+        GraphArena* previous_;
+    };
+
+private:
+    auto do_allocate(std::size_t bytes, std::size_t alignment) -> void* override;
+    auto do_deallocate(void* p, std::size_t bytes, std::size_t alignment) -> void override;
+    auto do_is_equal(const std::pmr::memory_resource& other) const noexcept -> bool override;
+
+    std::size_t capacity_;
+    std::unique_ptr<std::byte[]> buffer_;
+    std::optional<std::pmr::monotonic_buffer_resource> resource_;
+    std::size_t used_;  // bytes handed out since the last reset
+    std::size_t live_;  // allocations not yet returned
+};
+
+
+struct BackwardOptions {
+    // Keep the graph intact, e.g. to run backward() on it again
+    bool retain_graph = false;
+
+    // Run simplify() on the graph first
+    bool simplify = false;
+};
+
 // Compute gradient for computational graph starting with root node
-// based on topological sort
-auto backward(const ValuePtr& root) -> void;
+// based on topological sort. Local derivative rules are selected by
+// opcode, so they are inlined instead of called through a closure.
+// The sort is iterative (no recursion depth limit) and marks visited nodes
+// with a per-call epoch, so graphs sharing nodes must not be traversed
+// concurrently from different threads. Subgraphs without requires_grad are
+// neither sorted nor visited and their gradients are left untouched.
+//
+// Unless options.retain_graph is set, every node drops its operands as soon
+// as its rule has run, so intermediate nodes are freed during the pass
+// instead of when root goes out of scope. Afterwards root, and any
+// intermediate node the caller still holds, keeps its data and gradient but
+// is marked Op::released: backward(), topological_sort(), simplify() and
+// Program::trace() throw std::logic_error when they reach it. Pass
+// retain_graph to every backward() but the last to run a graph repeatedly.
+auto backward(const ValuePtr& root, BackwardOptions options = {}) -> void;
+
+// Apply the local derivative rule of v, accumulating into the gradients of
+// its operands. With atomic = true the accumulation uses atomic adds, so
+// nodes sharing operands can be processed concurrently.
+auto backward_step(const Value& v, bool atomic = false) -> void;
+
+// Nodes reachable from root, children before their parents. With grad_only
+// the walk does not descend into operands without requires_grad, i.e. it
+// yields the nodes backward() visits. The returned buffer is reused by the
+// next call (and by backward()) on this thread.
+[[nodiscard]] auto topological_sort(const ValuePtr& root, bool grad_only = false) -> const std::vector<Value*>&;
+
+// Rewrites the graph below root in place so that backward() (or a Program
+// traced from it) runs fewer rules: identity ops (x + 0, x * 1, pow(x, 1),
+// -(-x)) are bypassed and chains of scalar constants are fused, e.g.
+// (x * c1) * c2 into x * (c1 * c2) or c - (-x) into x + c. Values of the
+// nodes are left as they are. A node is only fused into its parent if no
+// other node of the graph uses it; bypassed and fused-away nodes receive no
+// gradient anymore, so only hold on to leaves and root across the call.
+auto simplify(const ValuePtr& root) -> void;
+
+
+// Leaf node, e.g. an input feature, without requires_grad. Like the nodes of
+// the operators below it lives on the active arena, if any.
+[[nodiscard]] auto leaf(double data) -> ValuePtr;
+
+// Node for a formula f evaluated outside the graph: data = f(x) and
+// derivative = f'(x). Built by fuse() in expr.h.
+[[nodiscard]] auto fused_node(double data, double derivative, const ValuePtr& x) -> ValuePtr;
 
 
 [[nodiscard]] auto operator+(const ValuePtr& left, const ValuePtr& right) -> ValuePtr;
@@ -76,5 +307,9 @@ auto backward(const ValuePtr& root) -> void;
 [[nodiscard]] auto tanh(const ValuePtr& v) -> ValuePtr;
 [[nodiscard]] auto relu(const ValuePtr& v) -> ValuePtr;
 
+// Fused reductions: a single node regardless of the number of operands
+[[nodiscard]] auto dot(std::span<const ValuePtr> ws, std::span<const ValuePtr> xs) -> ValuePtr;
+[[nodiscard]] auto sum(std::span<const ValuePtr> values) -> ValuePtr;
+
 
 } // namespace micrograd
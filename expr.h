@@ -0,0 +1,134 @@
+#pragma once
+
+#include <concepts>
+#include <functional>
+#include <type_traits>
+
+#include "dual.h"
+#include "engine.h"
+
+
+namespace micrograd {
+
+
+// Expression templates for short formulas of a single node, e.g. the hinge
+// loss of one score:
+//
+//   using micrograd::expr::arg;
+//   auto loss = fuse(relu(1.0 - y * arg), score);
+//
+// The formula is captured in the type of its expression (here a Unary<...,
+// Relu> over nested Binary nodes), so the compiler generates straight-line
+// code that evaluates it on a Dual: one pass yields the value and the local
+// derivative. fuse() then emits a single Op::fused node instead of one node
+// per op. Constants such as y are captured by value when the expression is
+// built.
+namespace expr {
+
+
+// Base of every expression type
+struct Node {};
+
+template <typename E>
+concept Expression = std::derived_from<std::remove_cvref_t<E>, Node>;
+
+template <typename T>
+concept Operand = Expression<T> || std::is_arithmetic_v<std::remove_cvref_t<T>>;
+
+
+// The node the formula is applied to
+struct Arg: Node {
+    auto operator()(Dual x) const -> Dual { return x; }
+};
+
+inline constexpr Arg arg{};
+
+struct Const: Node {
+    double value;
+
+    auto operator()(Dual) const -> Dual { return { value, 0.0 }; }
+};
+
+template <typename A, typename F>
+struct Unary: Node {
+    A a;
+
+    auto operator()(Dual x) const -> Dual { return F{}(a(x)); }
+};
+
+template <typename L, typename R, typename F>
+struct Binary: Node {
+    L left;
+    R right;
+
+    auto operator()(Dual x) const -> Dual { return F{}(left(x), right(x)); }
+};
+
+
+// Functions of Duals, as types
+struct Exp { auto operator()(Dual a) const -> Dual { return exp(a); } };
+struct Tanh { auto operator()(Dual a) const -> Dual { return tanh(a); } };
+struct Relu { auto operator()(Dual a) const -> Dual { return relu(a); } };
+struct Pow { auto operator()(Dual a, Dual b) const -> Dual { return pow(a, b); } };
+
+
+// Numbers become constants, expressions stay as they are
+template <Operand T>
+auto lift(const T& v) {
+    if constexpr (Expression<T>) {
+        return v;
+    } else {
+        return Const{ {}, static_cast<double>(v) };
+    }
+}
+
+template <typename F, Operand L, Operand R>
+auto make_binary(const L& left, const R& right) {
+    using LE = decltype(lift(left));
+    using RE = decltype(lift(right));
+    return Binary<LE, RE, F>{ {}, lift(left), lift(right) };
+}
+
+
+// Operators take at least one expression, so they never apply to ValuePtrs
+template <Operand L, Operand R> requires (Expression<L> || Expression<R>)
+auto operator+(const L& left, const R& right) { return make_binary<std::plus<>>(left, right); }
+
+template <Operand L, Operand R> requires (Expression<L> || Expression<R>)
+auto operator-(const L& left, const R& right) { return make_binary<std::minus<>>(left, right); }
+
+template <Operand L, Operand R> requires (Expression<L> || Expression<R>)
+auto operator*(const L& left, const R& right) { return make_binary<std::multiplies<>>(left, right); }
+
+template <Operand L, Operand R> requires (Expression<L> || Expression<R>)
+auto operator/(const L& left, const R& right) { return make_binary<std::divides<>>(left, right); }
+
+template <Expression E>
+auto operator-(const E& e) { return Unary<E, std::negate<>>{ {}, e }; }
+
+// Constant exponent only, like pow_const
+template <Expression E>
+auto pow(const E& base, double exp) { return make_binary<Pow>(base, exp); }
+
+template <Expression E>
+auto exp(const E& e) { return Unary<E, Exp>{ {}, e }; }
+
+template <Expression E>
+auto tanh(const E& e) { return Unary<E, Tanh>{ {}, e }; }
+
+template <Expression E>
+auto relu(const E& e) { return Unary<E, Relu>{ {}, e }; }
+
+
+} // namespace expr
+
+
+// Evaluate formula at x and emit it as one node, on the active arena if any
+template <expr::Expression E>
+[[nodiscard]] auto fuse(const E& formula, const ValuePtr& x) -> ValuePtr {
+    auto out = formula(Dual{ x->data, 1.0 });
+    return fused_node(out.value, out.tangent, x);
+}
+
+
+} // namespace micrograd
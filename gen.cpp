@@ -1,5 +1,7 @@
 #include "gen.h"
 
+#include <array>
+
 
 namespace micrograd {
 
@@ -7,7 +9,8 @@ namespace micrograd {
 DatasetGenerator::DatasetGenerator(unsigned int seed): gen_{ seed } {}
 
 auto DatasetGenerator::make_moons(std::size_t n_samples, double noise) -> Dataset {
-    auto ds = Dataset{};
+    auto ds = Dataset{ 2 };
+    ds.reserve(n_samples);
 
     std::normal_distribution<double> distr_noise(0.0, noise);
 
@@ -18,11 +21,7 @@ auto DatasetGenerator::make_moons(std::size_t n_samples, double noise) -> Datase
         auto angle = std::numbers::pi * static_cast<double>(i) / static_cast<double>(n_samples_per_moon);
         auto x = std::cos(angle) + distr_noise(gen_);
         auto y = std::sin(angle) + distr_noise(gen_);
-        ds.X.push_back({
-            std::make_shared<Value>(x),
-            std::make_shared<Value>(y)
-        });
-        ds.y.push_back(1.0);
+        ds.push_back(std::array{ x, y }, 1.0);
     }
 
     // Second moon
@@ -30,26 +29,11 @@ auto DatasetGenerator::make_moons(std::size_t n_samples, double noise) -> Datase
         auto angle = std::numbers::pi * static_cast<double>(i) / static_cast<double>(n_samples_per_moon);
         auto x = 1.0 - std::cos(angle) + distr_noise(gen_);
         auto y = 0.5 - std::sin(angle) + distr_noise(gen_);
-        ds.X.push_back({
-            std::make_shared<Value>(x),
-            std::make_shared<Value>(y)
-        });
-        ds.y.push_back(-1.0);
+        ds.push_back(std::array{ x, y }, -1.0);
     }
 
     return ds;
 }
 
 
-auto DatasetGenerator::save_csv(const Dataset& ds, const std::string& filename) -> void {
-    std::ofstream file(filename);
-    std::cout << "[micrograd::DatasetGenerator::save_csv] Saving dataset to file " << filename << "\n";
-    file << "x,y,label\n";
-    for (size_t i = 0; i < ds.X.size(); ++i) {
-        file << ds.X[i][0]->data << "," << ds.X[i][1]->data << "," << ds.y[i] << "\n";
-    }
-    file.close();
-}
-
-
 } // namespace micrograd
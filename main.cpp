@@ -1,23 +1,33 @@
 #include <tuple>
 
 #include "engine.h"
+#include "expr.h"
 #include "nn.h"
 #include "gen.h"
+#include "trace.h"
+#include "parallel.h"
+#include "optim.h"
+#include "checkpoint.h"
+#include "profile.h"
 
 
 auto test_simple_example() -> void;
 auto test_moons_dataset() -> void;
+auto test_moons_dataset_traced(bool native = false) -> void;
+auto test_moons_dataset_batched() -> void;
+auto test_moons_dataset_minibatch() -> void;
+auto test_moons_dataset_parallel() -> void;
+auto test_moons_dataset_hogwild() -> void;
 
 auto loss_f(
     const micrograd::MLP& model,
     const std::vector<std::vector<micrograd::ValuePtr>>& X,
-    const std::vector<double>& y
+    std::span<const double> y
 ) -> std::pair<micrograd::ValuePtr, double>;
 
 auto save_decision_boundary(
     const micrograd::MLP& model,
-    const std::vector<std::vector<micrograd::ValuePtr>>& X,
-    const std::vector<double>& y
+    const micrograd::Dataset& ds
 ) -> void;
 
 
@@ -25,6 +35,11 @@ auto main() -> int {
 
     //test_simple_example();
     test_moons_dataset();
+    //test_moons_dataset_traced();
+    //test_moons_dataset_batched();
+    //test_moons_dataset_minibatch();
+    //test_moons_dataset_parallel();
+    //test_moons_dataset_hogwild();
 
     return 0;
 }
@@ -54,18 +69,19 @@ auto test_simple_example() -> void {
         auto ypred = std::vector<ValuePtr>{};
         for (const auto& x: xs) ypred.push_back(nn(x)[0]);
 
-        auto loss = std::make_shared<Value>(0.0);
+        auto errors = std::vector<ValuePtr>{};
         for (std::size_t i = 0; i < ypred.size(); ++i) {
-            loss = loss + pow(ypred[i] - ys[i], 2.0);
+            errors.push_back(pow(ypred[i] - ys[i], 2.0));
         }
+        auto loss = sum(errors);
 
         // Backward pass
         nn.zero_grad();
         backward(loss);
 
         // Update
-        for (const auto& param: nn.parameters()) {
-            param->data -= learning_rate * param->grad;
+        for (auto& param: nn.parameter_values()) {
+            param.data -= learning_rate * param.grad;
         }
         
         // Print progress
@@ -78,45 +94,316 @@ auto test_moons_dataset() -> void {
     auto ds_gen = micrograd::DatasetGenerator();
     auto moons = ds_gen.make_moons(100, 0.1);
 
-    //micrograd::DatasetGenerator::save_csv(moons, "moons.csv");
+    //micrograd::save_csv(moons, "moons.csv");
+
+    // Inputs as graph leaves, once for all iterations
+    auto X = micrograd::to_values(moons);
+    auto y = moons.labels();
+
+    auto model = micrograd::MLP(2, { 16, 16, 1 });
+    std::cout << "Model (with " << model.parameters().size() << " parameters):\n" << model << "\n";
+
+    // Graph nodes of a training step live in the arena and are freed in bulk
+    auto arena = micrograd::GraphArena{};
+    auto optimizer = micrograd::SGD(model.parameter_values(), 1.0);
+
+#ifdef MICROGRAD_PROFILE
+    // Keep the individual scopes for the trace written at the end
+    micrograd::profile::enable_trace();
+#endif
+
+    // Training
+    std::size_t iterations = 100;
+    for (std::size_t k = 0; k < iterations; ++k) {
+        {
+            auto scope = micrograd::GraphArena::Scope{ arena };
+
+            MICROGRAD_PROFILE_SCOPE("step");
+
+            // Forward pass
+            auto res = [&]() {
+                MICROGRAD_PROFILE_SCOPE("forward");
+                return loss_f(model, X, y);
+            }();
+            auto& total_loss = res.first;
+            auto& acc = res.second;
+
+            // Backward pass
+            {
+                MICROGRAD_PROFILE_SCOPE("backward");
+                optimizer.zero_grad();
+                backward(total_loss);
+            }
+
+            // Update
+            {
+                MICROGRAD_PROFILE_SCOPE("update");
+                optimizer.set_learning_rate(1.0 - (0.9 * static_cast<double>(k) / 100));
+                optimizer.step();
+            }
+
+            // Print progress
+            if (k % 1 == 0) {
+                std::cout << "Iteration " << k << ", loss = " << total_loss->data << ", acc = " << acc * 100 << "%\n";
+            }
+        }
+
+        // All graph nodes of this step are gone, release them at once
+        arena.reset();
+    }
+
+    //save_decision_boundary(model, moons);
+    //micrograd::save_checkpoint(model, "moons.ckpt");
 
-    auto& X = moons.X;
-    auto& y = moons.y;
+#ifdef MICROGRAD_PROFILE
+    micrograd::profile::print_summary(std::cout);
+    micrograd::profile::write_chrome_trace("moons_trace.json");
+#endif
+}
+
+// With native = true the program is compiled to native code, which needs a
+// C compiler (cc) and a writable cache directory, see Program::compile()
+auto test_moons_dataset_traced(bool native) -> void {
+    auto ds_gen = micrograd::DatasetGenerator();
+    auto moons = ds_gen.make_moons(100, 0.1);
+
+    auto X = micrograd::to_values(moons);
+    auto y = moons.labels();
 
     auto model = micrograd::MLP(2, { 16, 16, 1 });
     std::cout << "Model (with " << model.parameters().size() << " parameters):\n" << model << "\n";
 
+    // Record model + loss once, the graph shape is the same in every iteration
+    auto program = micrograd::Program::trace(loss_f(model, X, y).first, model.parameters());
+    std::cout << "Traced program with " << program.size() << " instructions\n";
+
+    // Native code for the fixed graph, cached on disk for later runs
+    if (native) program.compile();
+
+    auto optimizer = micrograd::SGD(model.parameter_values(), 1.0);
+
     // Training
     std::size_t iterations = 100;
     for (std::size_t k = 0; k < iterations; ++k) {
         // Forward pass
-        auto res = loss_f(model, X, y);
-        auto& total_loss = res.first;
-        auto& acc = res.second;
+        auto total_loss = program.forward();
 
         // Backward pass
-        model.zero_grad();
-        backward(total_loss);
+        optimizer.zero_grad();
+        program.backward();
 
         // Update
-        double learning_rate = 1.0 - (0.9 * static_cast<double>(k) / 100);
-        for (const auto& param: model.parameters()) {
-            param->data -= learning_rate * param->grad;
+        optimizer.set_learning_rate(1.0 - (0.9 * static_cast<double>(k) / 100));
+        optimizer.step();
+
+        // Print progress
+        if (k % 1 == 0) {
+            std::cout << "Iteration " << k << ", loss = " << total_loss << "\n";
         }
-        
+    }
+}
+
+auto test_moons_dataset_batched() -> void {
+    auto ds_gen = micrograd::DatasetGenerator();
+    auto moons = ds_gen.make_moons(100, 0.1);
+
+    auto X = micrograd::to_tensor(moons);
+    auto y = moons.labels();
+
+    auto model = micrograd::MLP(2, { 16, 16, 1 });
+    std::cout << "Model (with " << model.parameters().size() << " parameters):\n" << model << "\n";
+
+    auto acts = std::vector<micrograd::Tensor>{};
+    auto n = static_cast<double>(y.size());
+    double alpha = 1e-4;
+
+    // The gradient of the L2 penalty alpha * p^2 is 2 * alpha * p
+    auto optimizer = micrograd::Adam(model.parameter_values(), 0.05, { .weight_decay = 2 * alpha });
+
+    // Training
+    std::size_t iterations = 100;
+    for (std::size_t k = 0; k < iterations; ++k) {
+        // Forward pass over the whole batch
+        auto& scores = model.forward(X, acts);
+
+        // Hinge loss and its gradient w.r.t. the scores
+        double data_loss = 0.0;
+        std::size_t correct_count = 0;
+        for (std::size_t i = 0; i < y.size(); ++i) {
+            auto margin = 1.0 - y[i] * scores.data[i];
+            data_loss += margin > 0.0 ? margin / n : 0.0;
+            scores.grad[i] = margin > 0.0 ? -y[i] / n : 0.0;
+
+            if ((scores.data[i] > 0) == (y[i] > 0)) correct_count++;
+        }
+
+        // Backward pass
+        optimizer.zero_grad();
+        model.backward(acts);
+
+        double reg_loss = 0.0;
+        for (const auto& param: model.parameter_values()) reg_loss += alpha * param.data * param.data;
+
+        // Update
+        optimizer.step();
+
         // Print progress
         if (k % 1 == 0) {
-            std::cout << "Iteration " << k << ", loss = " << total_loss->data << ", acc = " << acc * 100 << "%\n";
+            auto acc = static_cast<double>(correct_count) / n;
+            std::cout << "Iteration " << k << ", loss = " << data_loss + reg_loss << ", acc = " << acc * 100 << "%\n";
         }
     }
+}
+
+auto test_moons_dataset_minibatch() -> void {
+    auto ds_gen = micrograd::DatasetGenerator();
+    auto moons = ds_gen.make_moons(1000, 0.1);
+
+    auto model = micrograd::MLP(2, { 16, 16, 1 });
+    std::cout << "Model (with " << model.parameters().size() << " parameters):\n" << model << "\n";
 
-    //save_decision_boundary(model, X, y);
+    // Shuffled batches are prepared on a background thread during each step.
+    // They are gathered as float, so the forward and backward passes run in
+    // float while the optimizer updates the model's double parameters.
+    auto loader = micrograd::FloatDataLoader(moons, 32);
+    auto optimizer = micrograd::Adam(model.parameter_values(), 0.01);
+    auto acts = std::vector<micrograd::FloatTensor>{};
+
+    // Training
+    std::size_t epochs = 20;
+    for (std::size_t epoch = 0; epoch < epochs; ++epoch) {
+        double epoch_loss = 0.0;
+        std::size_t correct_count = 0;
+
+        while (auto batch = loader.next()) {
+            const auto& y = batch->y;
+            auto n = static_cast<double>(batch->size());
+
+            // Forward pass
+            auto& scores = model.forward(batch->x, acts);
+
+            // Hinge loss and its gradient w.r.t. the scores
+            double data_loss = 0.0;
+            for (std::size_t i = 0; i < y.size(); ++i) {
+                auto margin = 1.0 - y[i] * scores.data[i];
+                data_loss += margin > 0.0 ? margin / n : 0.0;
+                scores.grad[i] = margin > 0.0 ? static_cast<float>(-y[i] / n) : 0.0f;
+
+                if ((scores.data[i] > 0) == (y[i] > 0)) correct_count++;
+            }
+            epoch_loss += data_loss * n;
+
+            // Backward pass and update
+            optimizer.zero_grad();
+            model.backward(acts);
+            optimizer.step();
+        }
+
+        // Print progress
+        auto n = static_cast<double>(moons.size());
+        std::cout << "Epoch " << epoch << ", loss = " << epoch_loss / n << ", acc = " << static_cast<double>(correct_count) / n * 100 << "%\n";
+    }
+}
+
+auto test_moons_dataset_parallel() -> void {
+    using micrograd::ValuePtr;
+
+    auto ds_gen = micrograd::DatasetGenerator();
+    auto moons = ds_gen.make_moons(100, 0.1);
+
+    auto model = micrograd::MLP(2, { 16, 16, 1 });
+    std::cout << "Model (with " << model.parameters().size() << " parameters):\n" << model << "\n";
+
+    // Hinge loss of one shard, averaged over the whole dataset
+    auto n = static_cast<double>(moons.size());
+    auto shard_loss = [n](
+        const micrograd::MLP& m,
+        std::span<const std::vector<ValuePtr>> xs,
+        std::span<const double> ys
+    ) -> ValuePtr
+    {
+        // relu(1 - y * score) as one fused node per sample
+        using micrograd::expr::arg;
+        std::vector<ValuePtr> losses;
+        for (std::size_t i = 0; i < ys.size(); ++i) {
+            losses.push_back(micrograd::fuse(relu(1.0 - ys[i] * arg), m(xs[i])[0]));
+        }
+        return micrograd::sum(losses) * (1.0 / n);
+    };
+
+    auto pool = micrograd::ThreadPool{};
+    auto trainer = micrograd::DataParallelTrainer(model, pool, shard_loss);
+    std::cout << "Training on " << pool.size() << " threads\n";
+
+    double alpha = 1e-4;
+
+    // The gradient of the L2 penalty alpha * p^2 is 2 * alpha * p
+    auto optimizer = micrograd::SGD(model.parameter_values(), 1.0, { .weight_decay = 2 * alpha }, &pool);
+
+    // Training
+    std::size_t iterations = 100;
+    for (std::size_t k = 0; k < iterations; ++k) {
+        // Forward and backward pass, sharded over the pool
+        optimizer.zero_grad();
+        auto data_loss = trainer.compute_gradients(moons);
+
+        double reg_loss = 0.0;
+        for (const auto& param: model.parameter_values()) reg_loss += alpha * param.data * param.data;
+
+        // Update
+        optimizer.set_learning_rate(1.0 - (0.9 * static_cast<double>(k) / 100));
+        optimizer.step();
+
+        // Print progress
+        if (k % 1 == 0) {
+            std::cout << "Iteration " << k << ", loss = " << data_loss + reg_loss << "\n";
+        }
+    }
+}
+
+auto test_moons_dataset_hogwild() -> void {
+    using micrograd::ValuePtr;
+
+    auto ds_gen = micrograd::DatasetGenerator();
+    auto moons = ds_gen.make_moons(10000, 0.1);
+
+    auto model = micrograd::MLP(2, { 16, 16, 1 });
+    std::cout << "Model (with " << model.parameters().size() << " parameters):\n" << model << "\n";
+
+    // Hinge loss of one minibatch
+    auto batch_loss = [](
+        const micrograd::MLP& m,
+        std::span<const std::vector<ValuePtr>> xs,
+        std::span<const double> ys
+    ) -> ValuePtr
+    {
+        using micrograd::expr::arg;
+        std::vector<ValuePtr> losses;
+        for (std::size_t i = 0; i < ys.size(); ++i) {
+            losses.push_back(micrograd::fuse(relu(1.0 - ys[i] * arg), m(xs[i])[0]));
+        }
+        return micrograd::sum(losses) * (1.0 / static_cast<double>(ys.size()));
+    };
+
+    // Every thread updates the shared parameters as soon as its own
+    // minibatch is done, rereading them every 4 updates
+    auto pool = micrograd::ThreadPool{};
+    auto trainer = micrograd::HogwildTrainer(model, pool, batch_loss, { .learning_rate = 0.01, .batch_size = 4, .sync_every = 4, .report_every = 1000 });
+    std::cout << "Training on " << pool.size() << " threads\n";
+
+    std::size_t epochs = 5;
+    for (std::size_t epoch = 0; epoch < epochs; ++epoch) {
+        auto loss = trainer.train(moons, 1, [](std::size_t updates, double l) {
+            std::cout << "Update " << updates << ", loss = " << l << "\n";
+        });
+        std::cout << "Epoch " << epoch << ", loss = " << loss << "\n";
+    }
 }
 
 auto loss_f(
     const micrograd::MLP& model,
     const std::vector<std::vector<micrograd::ValuePtr>>& X,
-    const std::vector<double>& y
+    std::span<const double> y
 ) -> std::pair<micrograd::ValuePtr, double>
 {
     std::vector<micrograd::ValuePtr> scores;
@@ -124,19 +411,20 @@ auto loss_f(
     
     for (const auto& sample : X) scores.push_back(model(sample)[0]);
         
-    auto data_loss = std::make_shared<micrograd::Value>(0.0);
+    std::vector<micrograd::ValuePtr> losses;
+    losses.reserve(y.size());
+
     for (std::size_t i = 0; i < y.size(); ++i) {
         auto margin = 1.0 + ((-1.0 * y[i]) * scores[i]);
-        data_loss = data_loss + micrograd::relu(margin);
+        losses.push_back(micrograd::relu(margin));
     }
 
-    data_loss = data_loss * (1.0 / static_cast<double>(y.size()));
+    auto data_loss = micrograd::sum(losses) * (1.0 / static_cast<double>(y.size()));
 
+    // L2 penalty as a single p . p node
     double alpha = 1e-4;
-    auto reg_loss = std::make_shared<micrograd::Value>(0.0);
-    
-    for (const auto& p : model.parameters()) reg_loss = reg_loss + (p * p);
-    reg_loss = reg_loss * alpha;
+    const auto& params = model.parameters();
+    auto reg_loss = micrograd::dot(params, params) * alpha;
 
     auto total_loss = data_loss + reg_loss;
 
@@ -156,8 +444,7 @@ auto loss_f(
 
 auto save_decision_boundary(
     const micrograd::MLP& model,
-    const std::vector<std::vector<micrograd::ValuePtr>>& X,
-    const std::vector<double>& y
+    const micrograd::Dataset& ds
 ) -> void
 {
     double x_min = std::numeric_limits<double>::max();
@@ -165,9 +452,9 @@ auto save_decision_boundary(
     double y_min = std::numeric_limits<double>::max();
     double y_max = std::numeric_limits<double>::lowest();
 
-    for (const auto& sample: X) {
-        double val_x = sample[0]->data;
-        double val_y = sample[1]->data;
+    for (std::size_t i = 0; i < ds.size(); ++i) {
+        double val_x = ds.row(i)[0];
+        double val_y = ds.row(i)[1];
         if (val_x < x_min) x_min = val_x;
         if (val_x > x_max) x_max = val_x;
         if (val_y < y_min) y_min = val_y;
@@ -178,22 +465,28 @@ auto save_decision_boundary(
     x_min -= padding; x_max += padding;
     y_min -= padding; y_max += padding;
 
-    std::ofstream grid_file("moons_decision_boundary.csv");
-    grid_file << "x,y,score\n";
-
+    // Evaluate the whole grid as one batch, without building a graph
     double h = 0.1;
+    auto points = std::vector<std::pair<double, double>>{};
     for (double xx = x_min; xx <= x_max; xx += h) {
         for (double yy = y_min; yy <= y_max; yy += h) {
-            
-            std::vector<micrograd::ValuePtr> inputs = {
-                std::make_shared<micrograd::Value>(xx),
-                std::make_shared<micrograd::Value>(yy)
-            };
+            points.emplace_back(xx, yy);
+        }
+    }
+
+    auto grid = micrograd::Tensor(points.size(), 2);
+    for (std::size_t i = 0; i < points.size(); ++i) {
+        grid(i, 0) = points[i].first;
+        grid(i, 1) = points[i].second;
+    }
 
-            auto score = model(inputs)[0];
+    auto scores = model.predict(grid);
 
-            grid_file << xx << "," << yy << "," << score->data << "\n";
-        }
+    std::ofstream grid_file("moons_decision_boundary.csv");
+    grid_file << "x,y,score\n";
+
+    for (std::size_t i = 0; i < points.size(); ++i) {
+        grid_file << points[i].first << "," << points[i].second << "," << scores.data[i] << "\n";
     }
     
     grid_file.close();
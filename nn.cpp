@@ -1,57 +1,124 @@
 #include "nn.h"
 
 #include <random>
+#include <cmath>
 
 
 namespace micrograd {
 
 
+//
+// Module
+//
+
+auto Module::allocate(std::size_t n) -> ParameterBlock {
+    // Value has no default constructor, so keep the Values in a vector and
+    // hand out a pointer to its buffer that owns the vector
+    auto param = Value(0.0);
+    param.requires_grad = true;
+    auto storage = std::make_shared<std::vector<Value>>(n, param);
+    auto values = std::shared_ptr<Value[]>(storage, storage->data());
+
+    // Aliasing handles: they share ownership of the whole block
+    auto handles = std::make_shared<std::vector<ValuePtr>>();
+    handles->reserve(n);
+    for (auto& value: *storage) {
+        handles->emplace_back(values, &value);
+    }
+
+    return ParameterBlock{ std::move(values), std::move(handles) };
+}
+
+auto Module::bind(const ParameterBlock& block, std::size_t offset, std::size_t n) -> void {
+    block_ = block;
+    values_ = std::span<Value>(block.values.get() + offset, n);
+    params_ = std::span<const ValuePtr>(*block.handles).subspan(offset, n);
+}
+
+auto Module::copy(std::span<const Value> values) -> ParameterBlock {
+    auto block = allocate(values.size());
+    auto* dst = block.values.get();
+    for (std::size_t i = 0; i < values.size(); ++i) {
+        dst[i].data = values[i].data;
+        dst[i].grad = values[i].grad;
+    }
+
+    return block;
+}
+
+
 //
 // Neuron
 // 
 
 Neuron::Neuron(std::size_t nin, bool nonlin):
-    w_{},
-    b_{ std::make_shared<Value>(0.0) },
+    Neuron(allocate(nin + 1), 0, nin, nonlin)
+{
+    reset_parameters();
+}
+
+Neuron::Neuron(const ParameterBlock& block, std::size_t offset, std::size_t nin, bool nonlin):
+    nin_{ nin },
     nonlin_{ nonlin }
 {
-    w_.reserve(nin);
+    bind(block, offset, nin + 1);
+}
 
+auto Neuron::reset_parameters() -> void {
     // Random weight init in [-1.0, 1.0]
     static std::random_device rd;
     static std::mt19937 gen(rd());
     std::uniform_real_distribution<double> dist(-1.0, 1.0);
 
-    for (std::size_t i = 0; i < nin; ++i) {
-        w_.emplace_back(std::make_shared<Value>(dist(gen)));
+    for (std::size_t i = 0; i < nin_; ++i) {
+        values_[i].data = dist(gen);
     }
+    values_[nin_].data = 0.0;
 }
 
 auto Neuron::operator()(const std::vector<ValuePtr>& x) const -> ValuePtr {
-    if (w_.size() != x.size()) {
+    if (nin_ != x.size()) {
         throw std::invalid_argument(
-            std::format("Inputs need to be the same size as weights ({})!", w_.size())
+            std::format("Inputs need to be the same size as weights ({})!", nin_)
         );
     }
 
-    auto act = b_;
-    for (std::size_t i = 0; i < w_.size(); ++i) {
-        act = act + w_[i] * x[i]; 
-    }
+    // One fused node for w . x instead of a chain of 2 * nin nodes
+    auto act = dot(weights(), x) + bias();
 
     auto out = nonlin_ ? tanh(act) : act;
 
     return out;
 }
 
-auto Neuron::parameters() const -> std::vector<ValuePtr> {
-    auto params = std::vector<ValuePtr>{};
-    params.reserve(w_.size() + 1);
+auto Neuron::predict(std::span<const double> x) const -> double {
+    return evaluate(x);
+}
+
+auto Neuron::predict(std::span<const Dual> x) const -> Dual {
+    return evaluate(x);
+}
+
+template <typename S>
+auto Neuron::evaluate(std::span<const S> x) const -> S {
+    using std::tanh;
 
-    params.insert(params.end(), w_.begin(), w_.end());
-    params.push_back(b_);
+    if (nin_ != x.size()) {
+        throw std::invalid_argument(
+            std::format("Inputs need to be the same size as weights ({})!", nin_)
+        );
+    }
+
+    auto act = S{ values_[nin_].data };
+    for (std::size_t i = 0; i < nin_; ++i) {
+        act += values_[i].data * x[i];
+    }
+
+    return nonlin_ ? tanh(act) : act;
+}
 
-    return params;
+auto Neuron::clone() const -> Neuron {
+    return Neuron(copy(values_), 0, nin_, nonlin_);
 }
 
 
@@ -60,15 +127,29 @@ auto Neuron::parameters() const -> std::vector<ValuePtr> {
 // 
 
 Layer::Layer(std::size_t nin, std::size_t nout, bool nonlin):
-    neurons_{} 
+    Layer(allocate(nout * (nin + 1)), 0, nin, nout, nonlin)
 {
+    reset_parameters();
+}
+
+Layer::Layer(const ParameterBlock& block, std::size_t offset, std::size_t nin, std::size_t nout, bool nonlin):
+    neurons_{},
+    nin_{ nin },
+    nonlin_{ nonlin }
+{
+    bind(block, offset, nout * (nin + 1));
+
     neurons_.reserve(nout);
 
     for (std::size_t i = 0; i < nout; ++i) {
-        neurons_.emplace_back(nin, nonlin);
+        neurons_.emplace_back(block, offset + i * (nin + 1), nin, nonlin);
     }
 }
 
+auto Layer::reset_parameters() -> void {
+    for (auto& neuron: neurons_) neuron.reset_parameters();
+}
+
 auto Layer::operator()(const std::vector<ValuePtr>& x) const -> std::vector<ValuePtr> {
     auto out = std::vector<ValuePtr>{};
 
@@ -79,15 +160,89 @@ auto Layer::operator()(const std::vector<ValuePtr>& x) const -> std::vector<Valu
     return out;
 }
 
-auto Layer::parameters() const -> std::vector<ValuePtr> {
-    auto params = std::vector<ValuePtr>{};
+auto Layer::predict(std::span<const double> x, std::span<double> out) const -> void {
+    for (std::size_t j = 0; j < neurons_.size(); ++j) {
+        out[j] = neurons_[j].predict(x);
+    }
+}
 
-    for (const auto& neuron: neurons_) {
-        auto neuron_params = neuron.parameters();
-        params.insert(params.end(), neuron_params.begin(), neuron_params.end()); 
+auto Layer::predict(std::span<const Dual> x, std::span<Dual> out) const -> void {
+    for (std::size_t j = 0; j < neurons_.size(); ++j) {
+        out[j] = neurons_[j].predict(x);
+    }
+}
+
+template <typename T>
+auto Layer::forward(const BasicTensor<T>& x) const -> BasicTensor<T> {
+    if (x.cols() != nin()) {
+        throw std::invalid_argument(
+            std::format("Inputs need to have as many columns as the layer has inputs ({})!", nin())
+        );
     }
 
-    return params;
+    auto n = x.rows();
+    auto out = BasicTensor<T>(n, nout());
+
+    // Parameters are stored as rows [w_0 .. w_nin-1, b], one per neuron.
+    // Pack W^T (nin x nout) so that out = x * W^T + b is a plain gemm.
+    auto stride = nin() + 1;
+    auto wt = std::vector<T>(nin() * nout());
+    for (std::size_t j = 0; j < nout(); ++j) {
+        for (std::size_t i = 0; i < nin(); ++i) wt[i * nout() + j] = static_cast<T>(values_[j * stride + i].data);
+    }
+
+    for (std::size_t r = 0; r < n; ++r) {
+        for (std::size_t j = 0; j < nout(); ++j) out(r, j) = static_cast<T>(values_[j * stride + nin()].data);
+    }
+
+    kernels::gemm_nn(n, nout(), nin(), x.data.data(), wt.data(), out.data.data());
+
+    if (nonlin_) {
+        for (auto& v: out.data) v = std::tanh(v);
+    }
+
+    return out;
+}
+
+template <typename T>
+auto Layer::backward(BasicTensor<T>& x, const BasicTensor<T>& out) const -> void {
+    auto n = x.rows();
+
+    // Gradient w.r.t. the pre-activations
+    auto dz = out.grad;
+    if (nonlin_) {
+        for (std::size_t i = 0; i < dz.size(); ++i) dz[i] *= 1 - out.data[i] * out.data[i];
+    }
+
+    auto stride = nin() + 1;
+    auto w = std::vector<T>(nout() * nin());
+    for (std::size_t j = 0; j < nout(); ++j) {
+        for (std::size_t i = 0; i < nin(); ++i) w[j * nin() + i] = static_cast<T>(values_[j * stride + i].data);
+    }
+
+    // dW = dz^T * x, db = column sums of dz, dx = dz * W
+    auto dw = std::vector<T>(nout() * nin(), T{ 0 });
+    kernels::gemm_tn(nout(), nin(), n, dz.data(), x.data.data(), dw.data());
+
+    std::ranges::fill(x.grad, T{ 0 });
+    kernels::gemm_nn(n, nin(), nout(), dz.data(), w.data(), x.grad.data());
+
+    for (std::size_t j = 0; j < nout(); ++j) {
+        for (std::size_t i = 0; i < nin(); ++i) values_[j * stride + i].grad += dw[j * nin() + i];
+
+        double db = 0.0;
+        for (std::size_t r = 0; r < n; ++r) db += dz[r * nout() + j];
+        values_[j * stride + nin()].grad += db;
+    }
+}
+
+template auto Layer::forward(const Tensor& x) const -> Tensor;
+template auto Layer::forward(const FloatTensor& x) const -> FloatTensor;
+template auto Layer::backward(Tensor& x, const Tensor& out) const -> void;
+template auto Layer::backward(FloatTensor& x, const FloatTensor& out) const -> void;
+
+auto Layer::clone() const -> Layer {
+    return Layer(copy(values_), 0, nin_, nout(), nonlin_);
 }
 
 
@@ -95,17 +250,47 @@ auto Layer::parameters() const -> std::vector<ValuePtr> {
 // MLP
 // 
 
+namespace {
+
+auto count_parameters(std::size_t nin, const std::vector<std::size_t>& nouts) -> std::size_t {
+    std::size_t n = 0;
+    for (auto nout: nouts) {
+        n += nout * (nin + 1);
+        nin = nout;
+    }
+
+    return n;
+}
+
+} // namespace
+
 MLP::MLP(std::size_t nin, const std::vector<std::size_t>& nouts):
-    layers_{} 
+    MLP(allocate(count_parameters(nin, nouts)), nin, nouts)
+{
+    for (auto& layer: layers_) layer.reset_parameters();
+}
+
+MLP::MLP(const ParameterBlock& block, std::size_t nin, const std::vector<std::size_t>& nouts):
+    layers_{},
+    checkpoint_every_{ 1 }
 {
+    // predict(), jacobian() and clone() read the first and last layer
+    if (nouts.empty()) {
+        throw std::invalid_argument("An MLP needs at least one layer!");
+    }
+
+    bind(block, 0, count_parameters(nin, nouts));
+
     layers_.reserve(nouts.size());
 
     auto sz = std::vector<std::size_t>{ nin };
     sz.insert(sz.end(), nouts.begin(), nouts.end());
 
+    std::size_t offset = 0;
     for (std::size_t i = 0; i < nouts.size(); ++i) {
         bool is_output_layer = (i == nouts.size() - 1);
-        layers_.emplace_back(sz[i], sz[i+1], !is_output_layer);
+        layers_.emplace_back(block, offset, sz[i], sz[i+1], !is_output_layer);
+        offset += sz[i+1] * (sz[i] + 1);
     }
 }
 
@@ -118,15 +303,131 @@ auto MLP::operator()(const std::vector<ValuePtr>& x) const -> std::vector<ValueP
     return out;
 }
 
-auto MLP::parameters() const -> std::vector<ValuePtr> {
-    auto params = std::vector<ValuePtr>{};
+auto MLP::predict(std::span<const double> x) const -> std::vector<double> {
+    return evaluate(x);
+}
+
+auto MLP::predict(std::span<const Dual> x) const -> std::vector<Dual> {
+    return evaluate(x);
+}
+
+template <typename S>
+auto MLP::evaluate(std::span<const S> x) const -> std::vector<S> {
+    auto in = std::vector<S>(x.begin(), x.end());
+    auto out = std::vector<S>{};
 
     for (const auto& layer: layers_) {
-        auto layer_params = layer.parameters();
-        params.insert(params.end(), layer_params.begin(), layer_params.end());   
+        out.resize(layer.nout());
+        layer.predict(std::span<const S>(in), std::span<S>(out));
+        std::swap(in, out);
     }
 
-    return params;
+    return in;
+}
+
+auto MLP::jacobian(std::span<const double> x) const -> Tensor {
+    auto nin = layers_.front().nin();
+    auto nout = layers_.back().nout();
+
+    if (x.size() != nin) {
+        throw std::invalid_argument(
+            std::format("Inputs need to be the same size as the model's inputs ({})!", nin)
+        );
+    }
+
+    // Column j is the JVP along the j-th unit vector
+    auto jac = Tensor(nout, nin);
+    auto in = seed(x, std::vector<double>(nin, 0.0));
+    for (std::size_t j = 0; j < nin; ++j) {
+        in[j].tangent = 1.0;
+        auto out = predict(std::span<const Dual>(in));
+        in[j].tangent = 0.0;
+
+        for (std::size_t i = 0; i < nout; ++i) jac(i, j) = out[i].tangent;
+    }
+
+    return jac;
+}
+
+template <typename T>
+auto MLP::predict(const BasicTensor<T>& x) const -> BasicTensor<T> {
+    auto out = layers_.front().forward(x);
+    for (std::size_t l = 1; l < layers_.size(); ++l) {
+        out = layers_[l].forward(out);
+    }
+
+    return out;
+}
+
+template <typename T>
+auto MLP::forward(const BasicTensor<T>& x, std::vector<BasicTensor<T>>& acts) const -> BasicTensor<T>& {
+    auto n_layers = layers_.size();
+
+    acts.clear();
+    acts.resize(n_layers + 1);
+    acts[0] = x;
+
+    // Activations between checkpoints only live until the next layer ran
+    auto scratch = BasicTensor<T>{};
+    const auto* in = &acts[0];
+    for (std::size_t l = 0; l < n_layers; ++l) {
+        auto out = layers_[l].forward(*in);
+
+        if ((l + 1) % checkpoint_every_ == 0 || l + 1 == n_layers) {
+            acts[l + 1] = std::move(out);
+            in = &acts[l + 1];
+        } else {
+            scratch = std::move(out);
+            in = &scratch;
+        }
+    }
+
+    return acts.back();
+}
+
+template <typename T>
+auto MLP::backward(std::vector<BasicTensor<T>>& acts) const -> void {
+    // Segments [begin, end) start at a checkpoint, last segment first
+    for (auto end = layers_.size(); end > 0;) {
+        auto begin = (end - 1) / checkpoint_every_ * checkpoint_every_;
+
+        for (auto l = begin + 1; l < end; ++l) {
+            acts[l] = layers_[l - 1].forward(acts[l - 1]);
+        }
+
+        for (auto l = end; l-- > begin;) {
+            layers_[l].backward(acts[l], acts[l + 1]);
+        }
+
+        for (auto l = begin + 1; l < end; ++l) acts[l] = BasicTensor<T>{};
+
+        end = begin;
+    }
+}
+
+template auto MLP::predict(const Tensor& x) const -> Tensor;
+template auto MLP::predict(const FloatTensor& x) const -> FloatTensor;
+template auto MLP::forward(const Tensor& x, std::vector<Tensor>& acts) const -> Tensor&;
+template auto MLP::forward(const FloatTensor& x, std::vector<FloatTensor>& acts) const -> FloatTensor&;
+template auto MLP::backward(std::vector<Tensor>& acts) const -> void;
+template auto MLP::backward(std::vector<FloatTensor>& acts) const -> void;
+
+auto MLP::set_checkpoint_every(std::size_t k) -> void {
+    if (k == 0) {
+        throw std::invalid_argument("Checkpoint interval must be at least 1!");
+    }
+
+    checkpoint_every_ = k;
+}
+
+auto MLP::clone() const -> MLP {
+    auto nouts = std::vector<std::size_t>{};
+    for (const auto& layer: layers_) nouts.push_back(layer.nout());
+
+    auto replica = MLP(copy(values_), layers_.front().nin(), nouts);
+    replica.checkpoint_every_ = checkpoint_every_;
+
+    return replica;
 }
 
 
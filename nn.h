@@ -1,20 +1,54 @@
 #pragma once
 
+#include "dual.h"
 #include "engine.h"
+#include "tensor.h"
 
 
 namespace micrograd {
 
 
+// Contiguous storage for the parameters of a module tree. An MLP allocates
+// one block and its layers and neurons are views into consecutive ranges of
+// it, so passes over all parameters walk memory linearly. Each parameter is
+// still a whole graph node, so data and grad sit sizeof(Value) (80) bytes
+// apart: there is no packed array of weights or gradients that a loop could
+// load as a vector. handles[i] aliases values[i] and shares ownership of the
+// block; they are built once per block, and modules view their range.
+struct ParameterBlock {
+    std::shared_ptr<Value[]> values;
+    std::shared_ptr<const std::vector<ValuePtr>> handles;
+};
+
+
 class Module {
 public:
     virtual ~Module() = default;
 
-    virtual auto parameters() const -> std::vector<ValuePtr> = 0;
+    // Handles to the parameters, a view into the handles of the whole block
+    auto parameters() const -> std::span<const ValuePtr> { return params_; }
+
+    // The parameters themselves, contiguous in memory
+    auto parameter_values() const -> std::span<Value> { return values_; }
 
     auto zero_grad() -> void {
-        for (const auto& param: parameters()) param->grad = 0.0;
+        for (auto& param: values_) param.grad = 0.0;
     }
+
+protected:
+    Module() = default;
+
+    [[nodiscard]] static auto allocate(std::size_t n) -> ParameterBlock;
+
+    // New block holding a copy of values, e.g. for clone()
+    [[nodiscard]] static auto copy(std::span<const Value> values) -> ParameterBlock;
+
+    // View parameters [offset, offset + n) of block
+    auto bind(const ParameterBlock& block, std::size_t offset, std::size_t n) -> void;
+
+    ParameterBlock block_{};
+    std::span<Value> values_{};
+    std::span<const ValuePtr> params_{};
 };
 
 
@@ -22,18 +56,39 @@ class Neuron: public Module {
 public:
     explicit Neuron(std::size_t nin, bool nonlin = true);
 
+    // View nin weights and the bias at block[offset, offset + nin + 1),
+    // leaving their values untouched
+    Neuron(const ParameterBlock& block, std::size_t offset, std::size_t nin, bool nonlin);
+
     auto operator()(const std::vector<ValuePtr>& x) const -> ValuePtr;
 
-    auto parameters() const -> std::vector<ValuePtr>;
+    // Inference on plain doubles, no graph is built
+    auto predict(std::span<const double> x) const -> double;
+
+    // Forward-mode pass: the output and its derivative along x's tangents
+    auto predict(std::span<const Dual> x) const -> Dual;
+
+    // Copy with its own parameter Values
+    [[nodiscard]] auto clone() const -> Neuron;
+
+    // Random weights in [-1.0, 1.0], zero bias
+    auto reset_parameters() -> void;
+
+    auto weights() const -> std::span<const ValuePtr> { return params_.first(nin_); }
+    auto bias() const -> const ValuePtr& { return params_.back(); }
+    auto nin() const -> std::size_t { return nin_; }
+    auto nonlin() const -> bool { return nonlin_; }
 
     friend auto operator<<(std::ostream& stream, const Neuron& neuron) -> std::ostream& {
-        stream << std::format("{} Neuron({})", (neuron.nonlin_ ? "tanh" : "linear"), neuron.w_.size()); 
+        stream << std::format("{} Neuron({})", (neuron.nonlin_ ? "tanh" : "linear"), neuron.nin_); 
         return stream;
     }
 
 private:
-    std::vector<ValuePtr> w_;
-    ValuePtr b_;
+    template <typename S>
+    auto evaluate(std::span<const S> x) const -> S;
+
+    std::size_t nin_;
     bool nonlin_;
 };
 
@@ -42,9 +97,33 @@ class Layer: public Module {
 public:
     Layer(std::size_t nin, std::size_t nout, bool nonlin = true);
 
+    // View nout neurons at block[offset, offset + nout * (nin + 1)), laid out
+    // row-major as [w_0 .. w_nin-1, b] per neuron, leaving their values untouched
+    Layer(const ParameterBlock& block, std::size_t offset, std::size_t nin, std::size_t nout, bool nonlin);
+
     auto operator()(const std::vector<ValuePtr>& x) const -> std::vector<ValuePtr>;
 
-    auto parameters() const -> std::vector<ValuePtr>;
+    // Inference on plain doubles, no graph is built
+    auto predict(std::span<const double> x, std::span<double> out) const -> void;
+    auto predict(std::span<const Dual> x, std::span<Dual> out) const -> void;
+
+    // Batched forward pass, one sample per row of x. Builds no graph either,
+    // so it doubles as batched inference. T is float or double, see MLP.
+    template <typename T>
+    auto forward(const BasicTensor<T>& x) const -> BasicTensor<T>;
+
+    // Batched backward pass for out = forward(x): reads out.grad, accumulates
+    // into the parameters' grad and overwrites x.grad
+    template <typename T>
+    auto backward(BasicTensor<T>& x, const BasicTensor<T>& out) const -> void;
+
+    [[nodiscard]] auto clone() const -> Layer;
+
+    auto reset_parameters() -> void;
+
+    auto nin() const -> std::size_t { return nin_; }
+    auto nout() const -> std::size_t { return neurons_.size(); }
+    auto nonlin() const -> bool { return nonlin_; }
 
     friend auto operator<<(std::ostream& stream, const Layer& layer) -> std::ostream& {
         stream << "Layer of [ ";
@@ -60,16 +139,64 @@ public:
 
 private:
     std::vector<Neuron> neurons_;
+    std::size_t nin_;
+    bool nonlin_;
 };
 
 
 class MLP: public Module {
 public:
+    // One layer per entry of nouts, throws if there is none
     MLP(std::size_t nin, const std::vector<std::size_t>& nouts);
 
     auto operator()(const std::vector<ValuePtr>& x) const -> std::vector<ValuePtr>;
 
-    auto parameters() const -> std::vector<ValuePtr>;
+    // Inference on plain doubles, no graph is built
+    auto predict(std::span<const double> x) const -> std::vector<double>;
+
+    // Forward-mode pass, see Dual: the outputs and their derivatives along
+    // the tangents of x, i.e. one Jacobian-vector product
+    auto predict(std::span<const Dual> x) const -> std::vector<Dual>;
+
+    // d out_i / d x_j at x as an nout x nin matrix, one forward-mode pass
+    // per input, no graph is built
+    auto jacobian(std::span<const double> x) const -> Tensor;
+
+    // The batched methods below run in the precision of their tensors, float
+    // or double. Parameters always stay double: with float tensors they are
+    // rounded to float for each pass and the float gradients of a batch are
+    // accumulated into their double grad, so the optimizer updates a double
+    // master copy (mixed precision).
+
+    // Batched inference, one sample per row of x
+    template <typename T>
+    auto predict(const BasicTensor<T>& x) const -> BasicTensor<T>;
+
+    // Batched forward pass over a minibatch (one sample per row of x). Keeps
+    // the activations of the layers in acts (acts[0] = x) for backward(),
+    // with checkpointing only those at segment boundaries; the others are
+    // left empty.
+    template <typename T>
+    auto forward(const BasicTensor<T>& x, std::vector<BasicTensor<T>>& acts) const -> BasicTensor<T>&;
+
+    // Batched backward pass: reads acts.back().grad, set by the caller from
+    // the loss, and accumulates into the parameters' grad. With checkpointing
+    // the activations inside a segment are recomputed from its first one
+    // right before the segment is differentiated, and dropped afterwards.
+    template <typename T>
+    auto backward(std::vector<BasicTensor<T>>& acts) const -> void;
+
+    // Gradient checkpointing for the batched path: forward() keeps every k-th
+    // activation and the output, so memory holds about depth / k + k of them
+    // instead of depth, for one extra forward pass over the dropped ones.
+    // k around sqrt(depth) saves the most; k = 1 (the default) keeps all.
+    auto set_checkpoint_every(std::size_t k) -> void;
+    auto checkpoint_every() const -> std::size_t { return checkpoint_every_; }
+
+    // Copy with its own parameter Values, e.g. a per-thread replica
+    [[nodiscard]] auto clone() const -> MLP;
+
+    auto layers() const -> const std::vector<Layer>& { return layers_; }
 
     friend auto operator<<(std::ostream& stream, const MLP& mlp) -> std::ostream& {
         stream << "MLP of [ ";
@@ -84,7 +211,14 @@ public:
     }
 
 private:
+    // Layers viewing block, leaving the parameter values untouched
+    MLP(const ParameterBlock& block, std::size_t nin, const std::vector<std::size_t>& nouts);
+
+    template <typename S>
+    auto evaluate(std::span<const S> x) const -> std::vector<S>;
+
     std::vector<Layer> layers_;
+    std::size_t checkpoint_every_;
 };
 
 
@@ -0,0 +1,133 @@
+#include "optim.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "parallel.h"
+
+
+namespace micrograd {
+
+
+//
+// Optimizer
+//
+
+namespace {
+
+// Below this many parameters waking the pool costs more than the update
+constexpr std::size_t kMinParallelParams = 1 << 14;
+constexpr std::size_t kParamsPerTask = 1 << 12;
+
+} // namespace
+
+Optimizer::Optimizer(std::span<Value> params, double learning_rate, ThreadPool* pool):
+    params_{ params },
+    lr_{ learning_rate },
+    t_{ 0 },
+    pool_{ pool }
+{}
+
+auto Optimizer::step() -> void {
+    ++t_;
+
+    auto n = params_.size();
+    if (pool_ == nullptr || pool_->size() == 1 || n < kMinParallelParams) {
+        update(0, n);
+        return;
+    }
+
+    auto n_tasks = (n + kParamsPerTask - 1) / kParamsPerTask;
+    pool_->parallel_for(n_tasks, [&](std::size_t t) {
+        update(t * kParamsPerTask, std::min(n, (t + 1) * kParamsPerTask));
+    });
+}
+
+auto Optimizer::zero_grad() -> void {
+    for (auto& param: params_) param.grad = 0.0;
+}
+
+
+//
+// SGD
+//
+
+SGD::SGD(std::span<Value> params, double learning_rate, SGDOptions options, ThreadPool* pool):
+    Optimizer(params, learning_rate, pool),
+    options_{ options },
+    velocity_(options.momentum != 0.0 ? params.size() : 0, 0.0)
+{}
+
+auto SGD::update(std::size_t begin, std::size_t end) -> void {
+    auto* p = params_.data();
+    const auto lr = lr_;
+    const auto wd = options_.weight_decay;
+    const auto mu = options_.momentum;
+
+    if (velocity_.empty()) {
+        for (std::size_t i = begin; i < end; ++i) {
+            p[i].data -= lr * (p[i].grad + wd * p[i].data);
+        }
+        return;
+    }
+
+    auto* v = velocity_.data();
+    for (std::size_t i = begin; i < end; ++i) {
+        v[i] = mu * v[i] + (p[i].grad + wd * p[i].data);
+        p[i].data -= lr * v[i];
+    }
+}
+
+
+//
+// Adam
+//
+
+Adam::Adam(std::span<Value> params, double learning_rate, AdamOptions options, ThreadPool* pool):
+    Adam(params, learning_rate, options, pool, false)
+{}
+
+Adam::Adam(std::span<Value> params, double learning_rate, AdamOptions options, ThreadPool* pool, bool decoupled):
+    Optimizer(params, learning_rate, pool),
+    options_{ options },
+    decoupled_{ decoupled },
+    m_(params.size(), 0.0),
+    v_(params.size(), 0.0)
+{}
+
+auto Adam::update(std::size_t begin, std::size_t end) -> void {
+    auto* p = params_.data();
+    auto* m = m_.data();
+    auto* v = v_.data();
+
+    const auto [beta1, beta2, eps, weight_decay] = options_;
+    const auto t = static_cast<double>(t_);
+
+    // Bias corrections folded into two per-step scalars:
+    // p -= lr * (m / bc1) / (sqrt(v / bc2) + eps)
+    const auto step_size = lr_ / (1.0 - std::pow(beta1, t));
+    const auto inv_sqrt_bc2 = 1.0 / std::sqrt(1.0 - std::pow(beta2, t));
+
+    // Decoupled decay scales the parameter, coupled decay enters the gradient
+    const auto shrink = decoupled_ ? 1.0 - lr_ * weight_decay : 1.0;
+    const auto l2 = decoupled_ ? 0.0 : weight_decay;
+
+    for (std::size_t i = begin; i < end; ++i) {
+        auto g = p[i].grad + l2 * p[i].data;
+        m[i] = beta1 * m[i] + (1.0 - beta1) * g;
+        v[i] = beta2 * v[i] + (1.0 - beta2) * g * g;
+        p[i].data = shrink * p[i].data - step_size * m[i] / (std::sqrt(v[i]) * inv_sqrt_bc2 + eps);
+    }
+}
+
+
+//
+// AdamW
+//
+
+AdamW::AdamW(std::span<Value> params, double learning_rate, AdamOptions options, ThreadPool* pool):
+    Adam(params, learning_rate, options, pool, true)
+{}
+
+
+} // namespace micrograd
@@ -0,0 +1,115 @@
+#pragma once
+
+#include <cstddef>
+#include <span>
+#include <vector>
+
+#include "engine.h"
+
+
+namespace micrograd {
+
+
+class ThreadPool;
+
+
+// Base of the optimizers. They update a span of parameters, usually
+// MLP::parameter_values(), in place from their grad. Optimizer state lives in
+// contiguous arrays indexed like the parameters, and every update is a single
+// fused loop over them. The parameters themselves are whole Values, so data
+// and grad are strided by sizeof(Value) and the loops stay scalar. With a
+// pool, large models are updated in disjoint chunks on all of its threads.
+class Optimizer {
+public:
+    Optimizer(std::span<Value> params, double learning_rate, ThreadPool* pool = nullptr);
+    virtual ~Optimizer() = default;
+
+    Optimizer(const Optimizer&) = delete;
+    auto operator=(const Optimizer&) -> Optimizer& = delete;
+
+    // One update of all parameters from their current grad
+    auto step() -> void;
+
+    auto zero_grad() -> void;
+
+    auto learning_rate() const -> double { return lr_; }
+    auto set_learning_rate(double learning_rate) -> void { lr_ = learning_rate; }
+
+    // Number of step() calls so far
+    auto steps() const -> std::size_t { return t_; }
+
+protected:
+    // Update parameters [begin, end). Called with disjoint ranges from
+    // several threads at once during one step().
+    virtual auto update(std::size_t begin, std::size_t end) -> void = 0;
+
+    std::span<Value> params_;
+    double lr_;
+    std::size_t t_;
+
+private:
+    ThreadPool* pool_;
+};
+
+
+struct SGDOptions {
+    double momentum = 0.0;
+    double weight_decay = 0.0;  // L2 penalty, added to the gradient
+};
+
+// Stochastic gradient descent with optional (heavy ball) momentum:
+// v = momentum * v + g, p -= lr * v
+class SGD: public Optimizer {
+public:
+    SGD(std::span<Value> params, double learning_rate, SGDOptions options = {}, ThreadPool* pool = nullptr);
+
+protected:
+    auto update(std::size_t begin, std::size_t end) -> void override;
+
+private:
+    SGDOptions options_;
+    std::vector<double> velocity_;  // empty without momentum
+};
+
+
+struct AdamOptions {
+    double beta1 = 0.9;
+    double beta2 = 0.999;
+    double eps = 1e-8;
+    double weight_decay = 0.0;
+};
+
+// Adam (Kingma & Ba) with bias-corrected first and second moments.
+// weight_decay is an L2 penalty added to the gradient.
+class Adam: public Optimizer {
+public:
+    Adam(std::span<Value> params, double learning_rate = 1e-3, AdamOptions options = {}, ThreadPool* pool = nullptr);
+
+protected:
+    // decoupled = true makes weight_decay shrink the parameters directly
+    // instead of entering the moments, see AdamW
+    Adam(std::span<Value> params, double learning_rate, AdamOptions options, ThreadPool* pool, bool decoupled);
+
+    auto update(std::size_t begin, std::size_t end) -> void override;
+
+private:
+    AdamOptions options_;
+    bool decoupled_;
+    std::vector<double> m_;
+    std::vector<double> v_;
+};
+
+// Adam with decoupled weight decay (Loshchilov & Hutter):
+// p -= lr * weight_decay * p before the Adam update
+class AdamW: public Adam {
+public:
+    AdamW(
+        std::span<Value> params,
+        double learning_rate = 1e-3,
+        AdamOptions options = { .weight_decay = 1e-2 },
+        ThreadPool* pool = nullptr
+    );
+};
+
+
+} // namespace micrograd
@@ -0,0 +1,371 @@
+#include "parallel.h"
+
+#include <algorithm>
+#include <numeric>
+#include <utility>
+
+#include "profile.h"
+
+
+namespace micrograd {
+
+
+//
+// ThreadPool
+//
+
+ThreadPool::ThreadPool(std::size_t n_threads):
+    workers_{},
+    mutex_{},
+    wake_{},
+    done_{},
+    job_{ nullptr },
+    job_size_{ 0 },
+    next_{ 0 },
+    active_{ 0 },
+    generation_{ 0 },
+    error_{},
+    stop_{ false }
+{
+    n_threads = std::max<std::size_t>(n_threads, 1);
+    workers_.reserve(n_threads - 1);
+
+    for (std::size_t i = 0; i + 1 < n_threads; ++i) {
+        workers_.emplace_back([this]() { worker_loop(); });
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        auto lock = std::lock_guard{ mutex_ };
+        stop_ = true;
+    }
+    wake_.notify_all();
+
+    for (auto& worker: workers_) worker.join();
+}
+
+auto ThreadPool::parallel_for(std::size_t n, const std::function<void(std::size_t)>& f) -> void {
+    if (workers_.empty() || n <= 1) {
+        for (std::size_t i = 0; i < n; ++i) f(i);
+        return;
+    }
+
+    {
+        auto lock = std::lock_guard{ mutex_ };
+        job_ = &f;
+        job_size_ = n;
+        next_ = 0;
+        active_ = workers_.size();
+        error_ = nullptr;
+        ++generation_;
+    }
+    wake_.notify_all();
+
+    run_job();
+
+    auto lock = std::unique_lock{ mutex_ };
+    done_.wait(lock, [this]() { return active_ == 0; });
+    job_ = nullptr;
+
+    if (error_) std::rethrow_exception(std::exchange(error_, nullptr));
+}
+
+auto ThreadPool::worker_loop() -> void {
+    std::uint64_t seen = 0;
+
+    while (true) {
+        {
+            auto lock = std::unique_lock{ mutex_ };
+            wake_.wait(lock, [&]() { return stop_ || generation_ != seen; });
+            if (stop_) return;
+            seen = generation_;
+        }
+
+        run_job();
+
+        auto lock = std::lock_guard{ mutex_ };
+        if (--active_ == 0) done_.notify_one();
+    }
+}
+
+auto ThreadPool::run_job() -> void {
+    for (auto i = next_++; i < job_size_; i = next_++) {
+        try {
+            (*job_)(i);
+        } catch (...) {
+            auto lock = std::lock_guard{ mutex_ };
+            if (!error_) error_ = std::current_exception();
+        }
+    }
+}
+
+
+//
+// Parallel backward
+//
+
+namespace {
+
+// Levels with fewer nodes are not worth waking the pool for
+constexpr std::size_t kMinParallelLevel = 512;
+constexpr std::size_t kNodesPerTask = 256;
+
+thread_local std::vector<Value*> by_level;
+thread_local std::vector<std::size_t> level_begin;
+
+} // namespace
+
+auto backward(const ValuePtr& root, ThreadPool& pool) -> void {
+    const auto& topo = topological_sort(root, true);
+
+    // Height above the leaves, children come first in topo. Operands without
+    // requires_grad are not in topo and their level is stale.
+    for (auto* v: topo) {
+        std::uint32_t height = 0;
+        for (std::size_t i = 0; i < v->slot_count(); ++i) {
+            if (const auto& child = v->slot(i); Value::needs_grad(child)) height = std::max(height, child->level + 1);
+        }
+        v->level = height;
+    }
+
+    // Counting sort by level, root has the largest height
+    auto n_levels = static_cast<std::size_t>(root->level) + 1;
+    level_begin.assign(n_levels + 1, 0);
+    for (const auto* v: topo) ++level_begin[v->level + 1];
+    for (std::size_t l = 0; l < n_levels; ++l) level_begin[l + 1] += level_begin[l];
+
+    by_level.resize(topo.size());
+    auto fill = level_begin;
+    for (auto* v: topo) by_level[fill[v->level]++] = v;
+
+    root->grad = 1.0;
+
+    // Level 0 only holds leaves, which have nothing to propagate
+    for (std::size_t l = n_levels; l-- > 1;) {
+        auto* nodes = by_level.data() + level_begin[l];
+        auto n = level_begin[l + 1] - level_begin[l];
+
+        if (n < kMinParallelLevel || pool.size() == 1) {
+            for (std::size_t i = 0; i < n; ++i) backward_step(*nodes[i]);
+            continue;
+        }
+
+        auto n_tasks = (n + kNodesPerTask - 1) / kNodesPerTask;
+        pool.parallel_for(n_tasks, [&](std::size_t t) {
+            auto end = std::min(n, (t + 1) * kNodesPerTask);
+            for (std::size_t i = t * kNodesPerTask; i < end; ++i) backward_step(*nodes[i], true);
+#ifdef MICROGRAD_PROFILE
+            profile::detail::flush();
+#endif
+        });
+    }
+
+#ifdef MICROGRAD_PROFILE
+    profile::detail::flush();
+#endif
+}
+
+
+//
+// DataParallelTrainer
+//
+
+DataParallelTrainer::DataParallelTrainer(MLP& model, ThreadPool& pool, LossFn loss_fn, bool deterministic):
+    model_{ model },
+    pool_{ pool },
+    loss_fn_{ std::move(loss_fn) },
+    deterministic_{ deterministic },
+    replicas_{},
+    arenas_{},
+    losses_(pool.size(), 0.0),
+    mutex_{}
+{
+    for (std::size_t s = 0; s < pool_.size(); ++s) {
+        replicas_.push_back(model_.clone());
+        arenas_.push_back(std::make_unique<GraphArena>());
+    }
+}
+
+auto DataParallelTrainer::compute_gradients(DatasetView batch) -> double {
+    auto n_shards = std::min(replicas_.size(), batch.size());
+    auto params = model_.parameter_values();
+
+    auto run_shard = [&](std::size_t s) {
+        // Contiguous shards whose sizes differ by at most one sample
+        auto begin = s * batch.size() / n_shards;
+        auto end = (s + 1) * batch.size() / n_shards;
+        auto shard = batch.subview(begin, end - begin);
+
+        auto& replica = replicas_[s];
+        auto replica_params = replica.parameter_values();
+        for (std::size_t i = 0; i < params.size(); ++i) {
+            replica_params[i].data = params[i].data;
+            replica_params[i].grad = 0.0;
+        }
+
+        {
+            auto scope = GraphArena::Scope{ *arenas_[s] };
+            auto xs = to_values(shard);
+            auto loss = loss_fn_(replica, xs, shard.labels());
+            backward(loss);
+            losses_[s] = loss->data;
+        }
+        arenas_[s]->reset();
+
+        if (!deterministic_) {
+            auto lock = std::lock_guard{ mutex_ };
+            for (std::size_t i = 0; i < params.size(); ++i) params[i].grad += replica_params[i].grad;
+        }
+    };
+
+    pool_.parallel_for(n_shards, run_shard);
+
+    if (deterministic_) {
+        // Fixed shard order per parameter, parallel over parameter chunks
+        auto replica_params = std::vector<std::span<Value>>{};
+        for (std::size_t s = 0; s < n_shards; ++s) replica_params.push_back(replicas_[s].parameter_values());
+
+        auto n_chunks = pool_.size();
+        pool_.parallel_for(n_chunks, [&](std::size_t c) {
+            auto begin = c * params.size() / n_chunks;
+            auto end = (c + 1) * params.size() / n_chunks;
+            for (std::size_t i = begin; i < end; ++i) {
+                for (std::size_t s = 0; s < n_shards; ++s) params[i].grad += replica_params[s][i].grad;
+            }
+        });
+    }
+
+    double loss = 0.0;
+    for (std::size_t s = 0; s < n_shards; ++s) loss += losses_[s];
+
+    return loss;
+}
+
+
+//
+// HogwildTrainer
+//
+
+HogwildTrainer::HogwildTrainer(MLP& model, ThreadPool& pool, LossFn loss_fn, HogwildOptions options):
+    model_{ model },
+    pool_{ pool },
+    loss_fn_{ std::move(loss_fn) },
+    options_{ options },
+    replicas_{},
+    arenas_{},
+    gen_{ options.seed },
+    updates_{ 0 },
+    report_mutex_{}
+{
+    options_.batch_size = std::max<std::size_t>(options_.batch_size, 1);
+    options_.sync_every = std::max<std::size_t>(options_.sync_every, 1);
+
+    for (std::size_t w = 0; w < pool_.size(); ++w) {
+        replicas_.push_back(model_.clone());
+        arenas_.push_back(std::make_unique<GraphArena>());
+    }
+}
+
+auto HogwildTrainer::train(DatasetView data, std::size_t n_epochs, const ReportFn& report) -> double {
+    auto n_workers = std::min(replicas_.size(), data.size());
+    if (n_workers == 0 || n_epochs == 0) return 0.0;
+
+    auto params = model_.parameter_values();
+
+    // Deal one shuffled order out to the workers, so every worker sees all
+    // kinds of samples even if data is sorted by label
+    auto order = std::vector<std::size_t>(data.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::ranges::shuffle(order, gen_);
+
+    auto seeds = std::vector<std::uint64_t>(n_workers);
+    for (auto& seed: seeds) seed = gen_();
+
+    auto epoch_loss = std::vector<double>(n_workers, 0.0);
+    auto epoch_batches = std::vector<std::size_t>(n_workers, 0);
+
+    auto run_worker = [&](std::size_t w) {
+        auto samples = std::vector<std::size_t>{};
+        for (auto i = w; i < order.size(); i += n_workers) samples.push_back(order[i]);
+        auto worker_gen = std::mt19937_64{ seeds[w] };
+
+        auto& replica = replicas_[w];
+        auto replica_params = replica.parameter_values();
+        auto& arena = *arenas_[w];
+        auto lr = options_.learning_rate;
+
+        auto xs = std::vector<std::vector<ValuePtr>>{};
+        auto ys = std::vector<double>{};
+        std::size_t n_updates = 0;
+        double report_loss = 0.0;
+        std::size_t report_batches = 0;
+
+        for (std::size_t epoch = 0; epoch < n_epochs; ++epoch) {
+            std::ranges::shuffle(samples, worker_gen);
+            epoch_loss[w] = 0.0;
+            epoch_batches[w] = 0;
+
+            for (std::size_t begin = 0; begin < samples.size(); begin += options_.batch_size) {
+                auto end = std::min(samples.size(), begin + options_.batch_size);
+
+                // Other workers keep writing while we copy, so the replica
+                // may mix parameters from different points in time
+                if (n_updates % options_.sync_every == 0) {
+                    for (std::size_t i = 0; i < params.size(); ++i) {
+                        replica_params[i].data = std::atomic_ref<double>{ params[i].data }.load(std::memory_order_relaxed);
+                    }
+                }
+
+                double loss_value = 0.0;
+                {
+                    auto scope = GraphArena::Scope{ arena };
+                    for (auto k = begin; k < end; ++k) {
+                        xs.push_back(to_values(data.row(samples[k])));
+                        ys.push_back(data.label(samples[k]));
+                    }
+                    auto loss = loss_fn_(replica, xs, ys);
+                    backward(loss);
+                    loss_value = loss->data;
+                    xs.clear();
+                    ys.clear();
+                }
+                arena.reset();
+
+                // Parameters the minibatch did not touch cost no atomic
+                for (std::size_t i = 0; i < params.size(); ++i) {
+                    auto step = -lr * replica_params[i].grad;
+                    replica_params[i].grad = 0.0;
+                    if (step == 0.0) continue;
+
+                    std::atomic_ref<double>{ params[i].data }.fetch_add(step, std::memory_order_relaxed);
+                    replica_params[i].data += step;
+                }
+
+                ++n_updates;
+                epoch_loss[w] += loss_value;
+                ++epoch_batches[w];
+                report_loss += loss_value;
+                ++report_batches;
+
+                auto total = updates_.fetch_add(1, std::memory_order_relaxed) + 1;
+                if (report && options_.report_every > 0 && total % options_.report_every == 0) {
+                    auto lock = std::lock_guard{ report_mutex_ };
+                    report(total, report_loss / static_cast<double>(report_batches));
+                    report_loss = 0.0;
+                    report_batches = 0;
+                }
+            }
+        }
+    };
+
+    pool_.parallel_for(n_workers, run_worker);
+
+    auto loss = std::accumulate(epoch_loss.begin(), epoch_loss.end(), 0.0);
+    auto batches = std::accumulate(epoch_batches.begin(), epoch_batches.end(), std::size_t{ 0 });
+
+    return loss / static_cast<double>(batches);
+}
+
+
+} // namespace micrograd
@@ -0,0 +1,155 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <span>
+#include <thread>
+#include <vector>
+
+#include "data.h"
+#include "engine.h"
+#include "nn.h"
+
+
+namespace micrograd {
+
+
+// Fixed set of worker threads running index ranges. The calling thread takes
+// part in every parallel_for, so a pool of size n starts n - 1 threads.
+// parallel_for must not be called from several threads at once or nested.
+class ThreadPool {
+public:
+    explicit ThreadPool(std::size_t n_threads = std::thread::hardware_concurrency());
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    auto operator=(const ThreadPool&) -> ThreadPool& = delete;
+
+    auto size() const -> std::size_t { return workers_.size() + 1; }
+
+    // Runs f(i) for every i in [0, n) and returns once all calls are done.
+    // The first exception thrown by f is rethrown here.
+    auto parallel_for(std::size_t n, const std::function<void(std::size_t)>& f) -> void;
+
+private:
+    auto worker_loop() -> void;
+    auto run_job() -> void;
+
+    std::vector<std::thread> workers_;
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::condition_variable done_;
+    const std::function<void(std::size_t)>* job_;
+    std::size_t job_size_;
+    std::atomic<std::size_t> next_;
+    std::size_t active_;        // workers still running the current job
+    std::uint64_t generation_;  // bumped for every job
+    std::exception_ptr error_;
+    bool stop_;
+};
+
+
+// Parallel backward pass over a single graph. Nodes are grouped into levels
+// by their height above the leaves; nodes of one level never depend on each
+// other, so each level is split across the pool once all higher levels are
+// done. Gradients are accumulated with atomic adds, which only contend when
+// nodes of the same level share an operand. Small levels run on the calling
+// thread. Like backward(), it skips nodes without requires_grad.
+auto backward(const ValuePtr& root, ThreadPool& pool) -> void;
+
+
+// Data-parallel gradient computation for an MLP.
+//
+// A minibatch is split into one shard per pool thread. Every shard runs
+// forward and backward on its own replica of the model inside its own
+// GraphArena, and the replicas' gradients are then summed into the model's
+// parameters. With deterministic = true the sum is taken in shard order, so
+// results do not depend on thread timing; otherwise each shard adds its
+// gradients under a lock as soon as it is done.
+class DataParallelTrainer {
+public:
+    // Loss of one shard. The shard losses are summed, so terms averaged over
+    // the minibatch must be scaled by the full batch size.
+    using LossFn = std::function<ValuePtr(
+        const MLP& model,
+        std::span<const std::vector<ValuePtr>> X,
+        std::span<const double> y
+    )>;
+
+    DataParallelTrainer(MLP& model, ThreadPool& pool, LossFn loss_fn, bool deterministic = true);
+
+    // Accumulate the gradient of the loss over batch into the model's
+    // parameters and return the loss. Each shard turns its samples into
+    // graph leaves on its own arena.
+    auto compute_gradients(DatasetView batch) -> double;
+
+private:
+    MLP& model_;
+    ThreadPool& pool_;
+    LossFn loss_fn_;
+    bool deterministic_;
+
+    std::vector<MLP> replicas_;
+    std::vector<std::unique_ptr<GraphArena>> arenas_;
+    std::vector<double> losses_;
+    std::mutex mutex_;
+};
+
+
+struct HogwildOptions {
+    double learning_rate = 0.05;
+    std::size_t batch_size = 1;     // samples per update of one worker
+    // Updates a worker makes on its replica before it rereads the shared
+    // parameters, i.e. the staleness it tolerates. 1 = every update.
+    std::size_t sync_every = 1;
+    // Report the loss every that many updates over all workers, 0 = never
+    std::size_t report_every = 0;
+    std::uint64_t seed = 42;
+};
+
+// Lock-free asynchronous SGD (Hogwild). Every pool thread runs its own
+// worker over a share of the samples: it builds the graph of a minibatch on
+// its replica of the model, in its own GraphArena, and subtracts
+// learning_rate * grad from the model's parameters with relaxed atomic adds,
+// without waiting for the other workers. Updates of different workers
+// interleave freely, so results depend on thread timing; the model must not
+// be used elsewhere while train() runs.
+class HogwildTrainer {
+public:
+    using LossFn = DataParallelTrainer::LossFn;
+
+    // Called with the number of updates so far and the mean minibatch loss
+    // of the reporting worker since its last report. Calls are serialized.
+    using ReportFn = std::function<void(std::size_t updates, double loss)>;
+
+    HogwildTrainer(MLP& model, ThreadPool& pool, LossFn loss_fn, HogwildOptions options = {});
+
+    auto set_learning_rate(double lr) -> void { options_.learning_rate = lr; }
+
+    // Run n_epochs passes over data, each sample visited once per epoch by
+    // one worker in a shuffled order, and return the mean minibatch loss of
+    // the last epoch
+    auto train(DatasetView data, std::size_t n_epochs, const ReportFn& report = {}) -> double;
+
+    auto updates() const -> std::size_t { return updates_; }
+
+private:
+    MLP& model_;
+    ThreadPool& pool_;
+    LossFn loss_fn_;
+    HogwildOptions options_;
+
+    std::vector<MLP> replicas_;
+    std::vector<std::unique_ptr<GraphArena>> arenas_;
+    std::mt19937_64 gen_;    // sample orders, continued by every train()
+    std::atomic<std::size_t> updates_;
+    std::mutex report_mutex_;
+};
+
+
+} // namespace micrograd
@@ -0,0 +1,300 @@
+#include "profile.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <fstream>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+
+namespace micrograd::profile {
+
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+struct OpCounters {
+    std::atomic<std::uint64_t> nodes{ 0 };
+    std::atomic<std::uint64_t> bytes{ 0 };
+    std::atomic<std::uint64_t> backward_calls{ 0 };
+    std::atomic<std::uint64_t> sampled_calls{ 0 };
+    std::atomic<std::uint64_t> sampled_ns{ 0 };
+};
+
+struct Event {
+    const char* name;
+    std::uint32_t tid;
+    std::int64_t start_ns;  // since origin
+    std::int64_t duration_ns;
+};
+
+std::array<OpCounters, kOpCount> op_counters{};
+std::atomic<std::uint64_t> arena_peak{ 0 };
+
+struct Phase {
+    std::string name;
+    PhaseStats stats;
+};
+
+// Totals per phase in order of first appearance, raw events only for a trace
+std::mutex events_mutex;
+std::vector<Phase> phases;
+std::vector<Event> events;
+bool trace_enabled = false;
+std::uint64_t dropped_events = 0;
+const auto origin = Clock::now();
+
+// Small, stable thread ids for the trace
+auto thread_index() -> std::uint32_t {
+    static std::atomic<std::uint32_t> next{ 0 };
+    thread_local auto index = next++;
+    return index;
+}
+
+// Unambiguous op names, to_string() prints + for both add and add_const
+auto op_name(Op op) -> std::string_view {
+    switch (op) {
+    case Op::leaf: return "leaf";
+    case Op::add: return "add";
+    case Op::add_const: return "add_const";
+    case Op::sub: return "sub";
+    case Op::rsub_const: return "rsub_const";
+    case Op::neg: return "neg";
+    case Op::mul: return "mul";
+    case Op::mul_const: return "mul_const";
+    case Op::div: return "div";
+    case Op::rdiv_const: return "rdiv_const";
+    case Op::pow: return "pow";
+    case Op::pow_const: return "pow_const";
+    case Op::exp: return "exp";
+    case Op::tanh: return "tanh";
+    case Op::relu: return "relu";
+    case Op::fused: return "fused";
+    case Op::released: return "released";
+    case Op::dot: return "dot";
+    case Op::sum: return "sum";
+    }
+    return "?";
+}
+
+auto to_ns(Clock::duration d) -> std::int64_t {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(d).count();
+}
+
+} // namespace
+
+
+//
+// Queries
+//
+
+auto op_stats(Op op) -> OpStats {
+    detail::flush();
+
+    const auto& c = op_counters[static_cast<std::size_t>(op)];
+    auto calls = c.backward_calls.load(std::memory_order_relaxed);
+    auto sampled_calls = c.sampled_calls.load(std::memory_order_relaxed);
+    auto sampled_ns = c.sampled_ns.load(std::memory_order_relaxed);
+
+    // Mean time of the sampled rules times all rules
+    auto ns = sampled_calls != 0
+        ? static_cast<double>(sampled_ns) / static_cast<double>(sampled_calls) * static_cast<double>(calls)
+        : 0.0;
+
+    return {
+        c.nodes.load(std::memory_order_relaxed),
+        c.bytes.load(std::memory_order_relaxed),
+        calls,
+        static_cast<std::uint64_t>(ns)
+    };
+}
+
+auto phase_stats(const std::string& name) -> PhaseStats {
+    auto lock = std::lock_guard{ events_mutex };
+
+    auto it = std::ranges::find(phases, name, &Phase::name);
+    return it != phases.end() ? it->stats : PhaseStats{ 0, 0 };
+}
+
+auto enable_trace(bool enabled) -> void {
+    auto lock = std::lock_guard{ events_mutex };
+    trace_enabled = enabled;
+}
+
+auto peak_arena_bytes() -> std::uint64_t {
+    return arena_peak.load(std::memory_order_relaxed);
+}
+
+auto reset() -> void {
+    // Counters other threads have not published yet survive the reset
+    detail::flush();
+    for (auto& c: op_counters) {
+        c.nodes = 0;
+        c.bytes = 0;
+        c.backward_calls = 0;
+        c.sampled_calls = 0;
+        c.sampled_ns = 0;
+    }
+    arena_peak = 0;
+
+    auto lock = std::lock_guard{ events_mutex };
+    phases.clear();
+    events.clear();
+    dropped_events = 0;
+}
+
+
+//
+// Reports
+//
+
+auto print_summary(std::ostream& stream) -> void {
+    stream << std::format("{:<10} {:>12} {:>12} {:>14} {:>12} {:>10}\n",
+        "op", "nodes", "bytes", "backward", "backward ms", "ns/rule");
+
+    auto total = OpStats{ 0, 0, 0, 0 };
+    for (std::size_t i = 0; i < kOpCount; ++i) {
+        auto op = static_cast<Op>(i);
+        auto s = op_stats(op);
+        if (s.nodes == 0 && s.backward_calls == 0) continue;
+
+        auto ns_per_rule = s.backward_calls ? static_cast<double>(s.backward_ns) / static_cast<double>(s.backward_calls) : 0.0;
+        stream << std::format("{:<10} {:>12} {:>12} {:>14} {:>12.3f} {:>10.1f}\n",
+            op_name(op), s.nodes, s.bytes, s.backward_calls, static_cast<double>(s.backward_ns) * 1e-6, ns_per_rule);
+
+        total.nodes += s.nodes;
+        total.bytes += s.bytes;
+        total.backward_calls += s.backward_calls;
+        total.backward_ns += s.backward_ns;
+    }
+    stream << std::format("{:<10} {:>12} {:>12} {:>14} {:>12.3f}\n",
+        "total", total.nodes, total.bytes, total.backward_calls, static_cast<double>(total.backward_ns) * 1e-6);
+
+    if (auto peak = peak_arena_bytes(); peak != 0) {
+        stream << std::format("peak arena usage: {} bytes\n", peak);
+    }
+
+    // Phases in order of first appearance
+    auto lock = std::lock_guard{ events_mutex };
+    if (phases.empty()) return;
+
+    stream << std::format("\n{:<20} {:>10} {:>12} {:>12}\n", "phase", "count", "total ms", "mean ms");
+    for (const auto& [name, stats]: phases) {
+        const auto& [count, total_ns] = stats;
+        auto ms = static_cast<double>(total_ns) * 1e-6;
+        stream << std::format("{:<20} {:>10} {:>12.3f} {:>12.4f}\n", name, count, ms, ms / static_cast<double>(count));
+    }
+}
+
+auto write_chrome_trace(const std::string& filename) -> void {
+    std::ofstream file(filename);
+
+    file << "{\"traceEvents\": [\n";
+
+    {
+        auto lock = std::lock_guard{ events_mutex };
+        for (std::size_t i = 0; i < events.size(); ++i) {
+            const auto& e = events[i];
+            // Complete events, timestamps in microseconds
+            file << std::format(
+                R"(  {{"name": "{}", "ph": "X", "pid": 1, "tid": {}, "ts": {:.3f}, "dur": {:.3f}}}{})",
+                e.name, e.tid, static_cast<double>(e.start_ns) * 1e-3, static_cast<double>(e.duration_ns) * 1e-3,
+                i + 1 < events.size() ? ",\n" : "\n"
+            );
+        }
+    }
+
+    file << "], \"metadata\": {\"ops\": {";
+    bool first = true;
+    for (std::size_t i = 0; i < kOpCount; ++i) {
+        auto op = static_cast<Op>(i);
+        auto s = op_stats(op);
+        if (s.nodes == 0 && s.backward_calls == 0) continue;
+
+        file << std::format(
+            R"({}"{}": {{"nodes": {}, "bytes": {}, "backward_calls": {}, "backward_ns": {}}})",
+            first ? "" : ", ", op_name(op), s.nodes, s.bytes, s.backward_calls, s.backward_ns
+        );
+        first = false;
+    }
+    auto dropped = [] {
+        auto lock = std::lock_guard{ events_mutex };
+        return dropped_events;
+    }();
+    file << std::format("}}, \"peak_arena_bytes\": {}, \"dropped_events\": {}}}}}\n", peak_arena_bytes(), dropped);
+
+    if (!file) {
+        throw std::runtime_error(std::format("Could not write trace {}!", filename));
+    }
+}
+
+
+//
+// Scope
+//
+
+Scope::Scope(const char* name):
+    name_{ name },
+    start_{ Clock::now() }
+{}
+
+Scope::~Scope() {
+    auto end = Clock::now();
+    auto event = Event{ name_, thread_index(), to_ns(start_ - origin), to_ns(end - start_) };
+
+    auto lock = std::lock_guard{ events_mutex };
+
+    auto it = std::ranges::find_if(phases, [&](const Phase& p) { return p.name == name_; });
+    if (it == phases.end()) it = phases.insert(it, Phase{ name_, PhaseStats{ 0, 0 } });
+    ++it->stats.count;
+    it->stats.total_ns += static_cast<std::uint64_t>(event.duration_ns);
+
+    if (!trace_enabled) return;
+    if (events.size() < kMaxTraceEvents) {
+        events.push_back(event);
+    } else {
+        ++dropped_events;
+    }
+}
+
+
+//
+// Engine hooks
+//
+
+namespace detail {
+
+LocalCounters::~LocalCounters() {
+    flush();
+}
+
+auto flush() -> void {
+    auto& local = local_counters;
+
+    for (std::size_t i = 0; i < kOpCount; ++i) {
+        auto& c = op_counters[i];
+        auto add = [](std::atomic<std::uint64_t>& total, std::uint64_t& n) {
+            if (n != 0) total.fetch_add(std::exchange(n, 0), std::memory_order_relaxed);
+        };
+        add(c.nodes, local.nodes[i]);
+        add(c.bytes, local.bytes[i]);
+        add(c.backward_calls, local.backward_calls[i]);
+        add(c.sampled_calls, local.sampled_calls[i]);
+        add(c.sampled_ns, local.sampled_ns[i]);
+    }
+}
+
+auto record_arena(std::uint64_t bytes) -> void {
+    auto peak = arena_peak.load(std::memory_order_relaxed);
+    while (bytes > peak && !arena_peak.compare_exchange_weak(peak, bytes, std::memory_order_relaxed)) {}
+}
+
+} // namespace detail
+
+
+} // namespace micrograd::profile
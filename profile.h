@@ -0,0 +1,152 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <string>
+
+#include "engine.h"
+
+
+// Opt-in instrumentation of the engine and the training loop.
+//
+// Built with -DMICROGRAD_PROFILE, the engine counts the nodes it creates and
+// the backward rules it applies, per op, and times a sample of the rules;
+// MICROGRAD_PROFILE_SCOPE records the phases of a training step. Counters
+// are kept per thread and published at the end of every backward pass.
+// Phases are summed per name; the individual scopes are only kept for a
+// Chrome trace after enable_trace().
+// Without it the hooks and scopes compile to nothing; the functions below
+// still exist and report zeros.
+//
+//   micrograd::profile::enable_trace();
+//   {
+//       MICROGRAD_PROFILE_SCOPE("forward");
+//       loss = loss_f(model, X, y);
+//   }
+//   ...
+//   micrograd::profile::print_summary(std::cout);
+//   micrograd::profile::write_chrome_trace("trace.json");
+
+#ifdef MICROGRAD_PROFILE
+#define MICROGRAD_PROFILE_CONCAT_(a, b) a##b
+#define MICROGRAD_PROFILE_CONCAT(a, b) MICROGRAD_PROFILE_CONCAT_(a, b)
+#define MICROGRAD_PROFILE_SCOPE(name) \
+    ::micrograd::profile::Scope MICROGRAD_PROFILE_CONCAT(micrograd_profile_scope_, __LINE__){ name }
+#else
+#define MICROGRAD_PROFILE_SCOPE(name) static_cast<void>(0)
+#endif
+
+
+namespace micrograd::profile {
+
+
+struct OpStats {
+    std::uint64_t nodes;           // nodes created
+    std::uint64_t bytes;           // Value and operand storage of those nodes
+    std::uint64_t backward_calls;  // backward rules applied
+    std::uint64_t backward_ns;     // time spent in them, extrapolated from the timed sample
+};
+
+struct PhaseStats {
+    std::uint64_t count;
+    std::uint64_t total_ns;
+};
+
+// Counters of one op since the last reset(), as published by the threads
+// that ran a backward pass or exited, plus those of the calling thread
+auto op_stats(Op op) -> OpStats;
+
+// Totals of the scopes named name since the last reset()
+auto phase_stats(const std::string& name) -> PhaseStats;
+
+// Keep every scope from now on for write_chrome_trace(), at most
+// kMaxTraceEvents of them. Off by default, then only the per-phase totals
+// are kept and the memory of the profiler does not grow with the run.
+inline constexpr std::size_t kMaxTraceEvents = 1 << 20;
+auto enable_trace(bool enabled = true) -> void;
+
+// Largest graph a GraphArena held at one of its resets
+auto peak_arena_bytes() -> std::uint64_t;
+
+auto reset() -> void;
+
+// Per-op table (nodes, bytes, backward time) followed by the phases
+auto print_summary(std::ostream& stream) -> void;
+
+// Scopes recorded since enable_trace() as Chrome trace events
+// (chrome://tracing, Perfetto), with the op counters and the number of
+// scopes dropped beyond kMaxTraceEvents in the metadata
+auto write_chrome_trace(const std::string& filename) -> void;
+
+
+// Records a phase from construction to destruction, use MICROGRAD_PROFILE_SCOPE
+class Scope {
+public:
+    explicit Scope(const char* name);
+    ~Scope();
+
+    Scope(const Scope&) = delete;
+    auto operator=(const Scope&) -> Scope& = delete;
+
+private:
+    const char* name_;
+    std::chrono::steady_clock::time_point start_;
+};
+
+
+// Engine hooks. The per-op ones only touch counters of the calling thread,
+// flush() adds those to the shared totals.
+namespace detail {
+
+// One backward rule in this many is timed, two clock reads per rule would
+// cost more than most rules
+inline constexpr std::uint32_t kSampleEvery = 64;
+
+struct LocalCounters {
+    std::array<std::uint64_t, kOpCount> nodes{};
+    std::array<std::uint64_t, kOpCount> bytes{};
+    std::array<std::uint64_t, kOpCount> backward_calls{};
+    std::array<std::uint64_t, kOpCount> sampled_calls{};
+    std::array<std::uint64_t, kOpCount> sampled_ns{};
+    std::uint32_t tick{ 0 };
+
+    LocalCounters() = default;
+    LocalCounters(const LocalCounters&) = delete;
+    auto operator=(const LocalCounters&) -> LocalCounters& = delete;
+
+    // Publishes what the thread counted since its last flush()
+    ~LocalCounters();
+};
+
+inline thread_local LocalCounters local_counters{};
+
+inline auto record_node(Op op, std::uint64_t bytes) -> void {
+    auto i = static_cast<std::size_t>(op);
+    ++local_counters.nodes[i];
+    local_counters.bytes[i] += bytes;
+}
+
+// Counts a backward rule of op, true if this one is to be timed
+inline auto sample_backward(Op op) -> bool {
+    ++local_counters.backward_calls[static_cast<std::size_t>(op)];
+    return ++local_counters.tick % kSampleEvery == 0;
+}
+
+// Time of a rule that sample_backward() picked
+inline auto record_backward(Op op, std::uint64_t ns) -> void {
+    auto i = static_cast<std::size_t>(op);
+    ++local_counters.sampled_calls[i];
+    local_counters.sampled_ns[i] += ns;
+}
+
+// Add the calling thread's counters to the shared totals and clear them
+auto flush() -> void;
+
+auto record_arena(std::uint64_t bytes) -> void;
+
+} // namespace detail
+
+
+} // namespace micrograd::profile
@@ -0,0 +1,119 @@
+#include "tensor.h"
+
+#if defined(__AVX512F__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+
+namespace micrograd::kernels {
+
+
+namespace {
+
+// Block sizes: a kBlockK x kBlockN panel of B (128 KiB) stays in L2 while
+// every row of A streams over it
+constexpr std::size_t kBlockK = 64;
+
+template <typename T>
+constexpr std::size_t kBlockN = 128 * 1024 / (kBlockK * sizeof(T));
+
+// y[0, n) += a * x[0, n)
+inline auto axpy(std::size_t n, double a, const double* x, double* y) -> void {
+    std::size_t j = 0;
+
+#if defined(__AVX512F__)
+    auto va = _mm512_set1_pd(a);
+    for (; j + 8 <= n; j += 8) {
+        _mm512_storeu_pd(y + j, _mm512_fmadd_pd(va, _mm512_loadu_pd(x + j), _mm512_loadu_pd(y + j)));
+    }
+#elif defined(__AVX2__) && defined(__FMA__)
+    auto va = _mm256_set1_pd(a);
+    for (; j + 4 <= n; j += 4) {
+        _mm256_storeu_pd(y + j, _mm256_fmadd_pd(va, _mm256_loadu_pd(x + j), _mm256_loadu_pd(y + j)));
+    }
+#endif
+
+    for (; j < n; ++j) {
+        y[j] += a * x[j];
+    }
+}
+
+inline auto axpy(std::size_t n, float a, const float* x, float* y) -> void {
+    std::size_t j = 0;
+
+#if defined(__AVX512F__)
+    auto va = _mm512_set1_ps(a);
+    for (; j + 16 <= n; j += 16) {
+        _mm512_storeu_ps(y + j, _mm512_fmadd_ps(va, _mm512_loadu_ps(x + j), _mm512_loadu_ps(y + j)));
+    }
+#elif defined(__AVX2__) && defined(__FMA__)
+    auto va = _mm256_set1_ps(a);
+    for (; j + 8 <= n; j += 8) {
+        _mm256_storeu_ps(y + j, _mm256_fmadd_ps(va, _mm256_loadu_ps(x + j), _mm256_loadu_ps(y + j)));
+    }
+#endif
+
+    for (; j < n; ++j) {
+        y[j] += a * x[j];
+    }
+}
+
+template <typename T>
+auto gemm_nn_impl(std::size_t m, std::size_t n, std::size_t k, const T* A, const T* B, T* C) -> void {
+    for (std::size_t j0 = 0; j0 < n; j0 += kBlockN<T>) {
+        auto nb = std::min(kBlockN<T>, n - j0);
+
+        for (std::size_t p0 = 0; p0 < k; p0 += kBlockK) {
+            auto pe = std::min(p0 + kBlockK, k);
+
+            for (std::size_t i = 0; i < m; ++i) {
+                const auto* a = A + i * k;
+                auto* c = C + i * n + j0;
+                for (std::size_t p = p0; p < pe; ++p) {
+                    axpy(nb, a[p], B + p * n + j0, c);
+                }
+            }
+        }
+    }
+}
+
+template <typename T>
+auto gemm_tn_impl(std::size_t m, std::size_t n, std::size_t k, const T* A, const T* B, T* C) -> void {
+    for (std::size_t j0 = 0; j0 < n; j0 += kBlockN<T>) {
+        auto nb = std::min(kBlockN<T>, n - j0);
+
+        for (std::size_t p0 = 0; p0 < k; p0 += kBlockK) {
+            auto pe = std::min(p0 + kBlockK, k);
+
+            for (std::size_t i = 0; i < m; ++i) {
+                auto* c = C + i * n + j0;
+                for (std::size_t p = p0; p < pe; ++p) {
+                    axpy(nb, A[p * m + i], B + p * n + j0, c);
+                }
+            }
+        }
+    }
+}
+
+} // namespace
+
+
+auto gemm_nn(std::size_t m, std::size_t n, std::size_t k, const double* A, const double* B, double* C) -> void {
+    gemm_nn_impl(m, n, k, A, B, C);
+}
+
+auto gemm_nn(std::size_t m, std::size_t n, std::size_t k, const float* A, const float* B, float* C) -> void {
+    gemm_nn_impl(m, n, k, A, B, C);
+}
+
+
+auto gemm_tn(std::size_t m, std::size_t n, std::size_t k, const double* A, const double* B, double* C) -> void {
+    gemm_tn_impl(m, n, k, A, B, C);
+}
+
+auto gemm_tn(std::size_t m, std::size_t n, std::size_t k, const float* A, const float* B, float* C) -> void {
+    gemm_tn_impl(m, n, k, A, B, C);
+}
+
+
+} // namespace micrograd::kernels
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <span>
+#include <vector>
+
+
+namespace micrograd {
+
+
+// Dense row-major matrix with a gradient buffer of the same shape. The
+// batched Layer / MLP path stores one sample per row. T is float or double;
+// float halves the memory traffic and doubles the SIMD width of the kernels.
+template <typename T>
+class BasicTensor {
+public:
+    std::vector<T> data;
+    std::vector<T> grad;
+
+public:
+    BasicTensor(std::size_t rows = 0, std::size_t cols = 0):
+        data(rows * cols, T{ 0 }),
+        grad(rows * cols, T{ 0 }),
+        rows_{ rows },
+        cols_{ cols }
+    {}
+
+    auto rows() const -> std::size_t { return rows_; }
+    auto cols() const -> std::size_t { return cols_; }
+
+    auto operator()(std::size_t r, std::size_t c) -> T& { return data[r * cols_ + c]; }
+    auto operator()(std::size_t r, std::size_t c) const -> T { return data[r * cols_ + c]; }
+
+    auto row(std::size_t r) -> std::span<T> { return { data.data() + r * cols_, cols_ }; }
+    auto row(std::size_t r) const -> std::span<const T> { return { data.data() + r * cols_, cols_ }; }
+
+    auto zero_grad() -> void { std::fill(grad.begin(), grad.end(), T{ 0 }); }
+
+    // Copy of the values in another precision, with a zero gradient
+    template <typename U>
+    auto cast() const -> BasicTensor<U> {
+        auto out = BasicTensor<U>(rows_, cols_);
+        std::transform(data.begin(), data.end(), out.data.begin(), [](T v) { return static_cast<U>(v); });
+        return out;
+    }
+
+private:
+    std::size_t rows_;
+    std::size_t cols_;
+};
+
+using Tensor = BasicTensor<double>;
+using FloatTensor = BasicTensor<float>;
+
+
+// Cache-blocked matrix kernels on contiguous row-major buffers. The inner
+// loops use AVX-512 or AVX2/FMA when the translation unit is compiled for
+// them (e.g. -march=native) and fall back to scalar code otherwise.
+namespace kernels {
+
+// C[m x n] += A[m x k] * B[k x n]
+auto gemm_nn(std::size_t m, std::size_t n, std::size_t k, const double* A, const double* B, double* C) -> void;
+auto gemm_nn(std::size_t m, std::size_t n, std::size_t k, const float* A, const float* B, float* C) -> void;
+
+// C[m x n] += A[k x m]^T * B[k x n]
+auto gemm_tn(std::size_t m, std::size_t n, std::size_t k, const double* A, const double* B, double* C) -> void;
+auto gemm_tn(std::size_t m, std::size_t n, std::size_t k, const float* A, const float* B, float* C) -> void;
+
+} // namespace kernels
+
+
+} // namespace micrograd
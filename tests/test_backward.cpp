@@ -0,0 +1,110 @@
+// Reusing a graph after backward() released it must fail loudly instead of
+// silently producing wrong gradients; retain_graph keeps it reusable.
+
+#include <cmath>
+#include <functional>
+#include <iostream>
+#include <stdexcept>
+#include <string_view>
+#include <vector>
+
+#include "engine.h"
+#include "trace.h"
+
+
+namespace {
+
+using micrograd::BackwardOptions;
+using micrograd::Op;
+using micrograd::ValuePtr;
+
+int failures = 0;
+
+auto check(bool ok, std::string_view what) -> void {
+    if (!ok) {
+        std::cerr << "FAILED: " << what << "\n";
+        ++failures;
+    }
+}
+
+auto throws_released(const std::function<void()>& f) -> bool {
+    try {
+        f();
+    } catch (const std::logic_error& e) {
+        return std::string_view(e.what()).find("retain_graph") != std::string_view::npos;
+    }
+    return false;
+}
+
+auto param(double data) -> ValuePtr {
+    auto p = micrograd::leaf(data);
+    p->requires_grad = true;
+    return p;
+}
+
+auto test_second_backward_throws() -> void {
+    auto w = param(2.0);
+    auto b = w * w;
+    auto c = tanh(b) + 1.0;
+
+    backward(c);
+    auto expected = (1 - std::tanh(4.0) * std::tanh(4.0)) * 2 * 2.0;
+    check(std::abs(w->grad - expected) < 1e-12, "backward computes dw");
+    check(b->op == Op::released && c->op == Op::released, "intermediate nodes are released");
+    check(w->op == Op::leaf, "parameters stay leaves");
+    check(c->data == std::tanh(4.0) + 1.0, "released nodes keep their data");
+
+    check(throws_released([&] { backward(c); }), "backward() on a released root throws");
+    check(throws_released([&] { backward(b); }), "backward() on a released intermediate throws");
+    check(w->grad == expected, "a rejected backward() leaves gradients alone");
+}
+
+auto test_shared_intermediate_throws() -> void {
+    auto w = param(3.0);
+    auto h = w * w;
+    auto l1 = h + 1.0;
+    auto l2 = h * 2.0;
+
+    backward(l1);
+    check(throws_released([&] { backward(l2); }), "backward() through a released shared node throws");
+    check(w->grad == 6.0, "dw only holds the first pass");
+}
+
+auto test_trace_throws() -> void {
+    auto w = param(0.5);
+    auto y = exp(w * 2.0);
+
+    backward(y);
+    check(throws_released([&] { (void)micrograd::Program::trace(y, std::vector<ValuePtr>{ w }); }), "Program::trace() of a released graph throws");
+    check(throws_released([&] { (void)micrograd::topological_sort(y); }), "topological_sort() of a released graph throws");
+}
+
+auto test_retain_graph() -> void {
+    auto w = param(3.0);
+    auto h = w * w;
+    auto l1 = h + 1.0;
+    auto l2 = h * 2.0;
+
+    backward(l1, BackwardOptions{ .retain_graph = true });
+    auto first = w->grad;
+    check(!throws_released([&] { backward(l1, BackwardOptions{ .retain_graph = true }); }), "retain_graph lets backward() run twice on the same root");
+    check(!throws_released([&] { backward(l2); }), "retain_graph lets a second backward() reuse shared nodes");
+    check(w->grad > first, "the passes after a retained one still reach dw");
+    check(h->op == Op::released, "the last backward() releases the graph");
+}
+
+}
+
+
+auto main() -> int {
+    test_second_backward_throws();
+    test_shared_intermediate_throws();
+    test_trace_throws();
+    test_retain_graph();
+
+    if (failures != 0) {
+        std::cerr << failures << " check(s) failed\n";
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,288 @@
+#include "trace.h"
+
+#include <cmath>
+#include <stdexcept>
+#include <unordered_map>
+
+
+namespace micrograd {
+
+
+auto Program::trace(
+    const ValuePtr& root,
+    std::span<const ValuePtr> params,
+    const std::vector<ValuePtr>& inputs,
+    const std::vector<ValuePtr>& outputs
+) -> Program
+{
+    auto program = Program{};
+    auto slots = std::unordered_map<const Value*, std::uint32_t>{};
+    auto frozen = std::vector<bool>{};  // per slot: constant at trace time
+
+    auto slot_of = [&](const Value* v) -> std::uint32_t {
+        auto [it, inserted] = slots.try_emplace(v, static_cast<std::uint32_t>(program.data_.size()));
+        if (inserted) {
+            program.data_.push_back(v->data);
+            frozen.push_back(v->op == Op::leaf);
+        }
+        return it->second;
+    };
+
+    // Params and inputs get slots even if root does not depend on them
+    for (const auto& p: params) {
+        program.params_.push_back(p);
+        program.param_slots_.push_back(slot_of(p.get()));
+        frozen[program.param_slots_.back()] = false;
+    }
+    for (const auto& in: inputs) {
+        program.input_slots_.push_back(slot_of(in.get()));
+        frozen[program.input_slots_.back()] = false;
+    }
+
+    for (const auto* v: topological_sort(root)) {
+        auto out = slot_of(v);
+        if (v->op == Op::leaf) continue;
+
+        if (v->op == Op::dot || v->op == Op::sum) {
+            auto offset = static_cast<std::uint32_t>(program.args_.size());
+            bool constant = true;
+            for (const auto& operand: v->operands) {
+                auto slot = slot_of(operand.get());
+                program.args_.push_back(slot);
+                constant = constant && frozen[slot];
+            }
+
+            // Constant folding: the slot already holds the node's value
+            if (constant) {
+                program.args_.resize(offset);
+                frozen[out] = true;
+                continue;
+            }
+
+            program.code_.push_back(Instr{
+                v->op,
+                out,
+                offset,
+                static_cast<std::uint32_t>(v->operands.size()),
+                v->saved
+            });
+            continue;
+        }
+
+        // The formula behind a fused node is not kept in the graph
+        if (v->op == Op::fused) {
+            throw std::invalid_argument("Program::trace: fused nodes cannot be replayed, build the graph from plain ops!");
+        }
+
+        const auto& [a, b] = v->children;
+        auto instr = Instr{ v->op, out, slot_of(a.get()), b ? slot_of(b.get()) : 0, v->saved };
+
+        if (frozen[instr.a] && (!b || frozen[instr.b])) {
+            frozen[out] = true;
+            continue;
+        }
+
+        // A binary op with one frozen operand becomes its *_const form,
+        // which reads the constant from the instruction
+        if (b && (frozen[instr.a] || frozen[instr.b])) {
+            auto left_const = frozen[instr.a];
+            auto k = program.data_[left_const ? instr.a : instr.b];
+            auto x = left_const ? instr.b : instr.a;
+
+            switch (v->op) {
+            case Op::add: instr = Instr{ Op::add_const, out, x, 0, k }; break;
+            case Op::mul: instr = Instr{ Op::mul_const, out, x, 0, k }; break;
+            case Op::sub: instr = left_const ? Instr{ Op::rsub_const, out, x, 0, k } : Instr{ Op::add_const, out, x, 0, -k }; break;
+            case Op::div: if (left_const) instr = Instr{ Op::rdiv_const, out, x, 0, k }; break;
+            case Op::pow: if (!left_const) instr = Instr{ Op::pow_const, out, x, 0, k }; break;
+            default: break;
+            }
+        }
+
+        program.code_.push_back(instr);
+    }
+
+    for (const auto& o: outputs) {
+        auto it = slots.find(o.get());
+        if (it == slots.end()) {
+            throw std::invalid_argument("Program::trace: output is not part of the traced graph!");
+        }
+        program.output_slots_.push_back(it->second);
+    }
+
+    program.root_ = slots.at(root.get());
+    program.grad_.resize(program.data_.size());
+
+    return program;
+}
+
+
+auto Program::forward() -> double {
+    for (std::size_t i = 0; i < params_.size(); ++i) {
+        data_[param_slots_[i]] = params_[i]->data;
+    }
+
+    auto* d = data_.data();
+    const auto* args = args_.data();
+
+    if (native_forward_) {
+        native_forward_(d);
+        return d[root_];
+    }
+
+    for (const auto& [op, out, a, b, saved]: code_) {
+        switch (op) {
+        case Op::leaf:
+        case Op::fused:  // rejected by trace()
+        case Op::released:  // rejected by trace()
+            break;
+        case Op::add:
+            d[out] = d[a] + d[b];
+            break;
+        case Op::add_const:
+            d[out] = d[a] + saved;
+            break;
+        case Op::sub:
+            d[out] = d[a] - d[b];
+            break;
+        case Op::rsub_const:
+            d[out] = saved - d[a];
+            break;
+        case Op::neg:
+            d[out] = -d[a];
+            break;
+        case Op::mul:
+            d[out] = d[a] * d[b];
+            break;
+        case Op::mul_const:
+            d[out] = d[a] * saved;
+            break;
+        case Op::div:
+            d[out] = d[a] / d[b];
+            break;
+        case Op::rdiv_const:
+            d[out] = saved / d[a];
+            break;
+        case Op::pow:
+            d[out] = std::pow(d[a], d[b]);
+            break;
+        case Op::pow_const:
+            d[out] = std::pow(d[a], saved);
+            break;
+        case Op::exp:
+            d[out] = std::exp(d[a]);
+            break;
+        case Op::tanh:
+            d[out] = (std::exp(2 * d[a]) - 1) / (std::exp(2 * d[a]) + 1);
+            break;
+        case Op::relu:
+            d[out] = d[a] < 0.0 ? 0.0 : d[a];
+            break;
+        case Op::dot: {
+            const auto* ws = args + a;
+            const auto* xs = ws + b / 2;
+            double acc = 0.0;
+            for (std::uint32_t i = 0; i < b / 2; ++i) acc += d[ws[i]] * d[xs[i]];
+            d[out] = acc;
+            break;
+        }
+        case Op::sum: {
+            double acc = 0.0;
+            for (std::uint32_t i = 0; i < b; ++i) acc += d[args[a + i]];
+            d[out] = acc;
+            break;
+        }
+        }
+    }
+
+    return d[root_];
+}
+
+
+auto Program::backward() -> void {
+    std::ranges::fill(grad_, 0.0);
+    grad_[root_] = 1.0;
+
+    const auto* d = data_.data();
+    auto* g = grad_.data();
+    const auto* args = args_.data();
+
+    if (native_backward_) {
+        native_backward_(d, g);
+    } else {
+        for (auto it = code_.rbegin(); it != code_.rend(); ++it) {
+            const auto& [op, out, a, b, saved] = *it;
+
+            switch (op) {
+            case Op::leaf:
+            case Op::fused:  // rejected by trace()
+            case Op::released:  // rejected by trace()
+                break;
+            case Op::add:
+                g[a] += g[out];
+                g[b] += g[out];
+                break;
+            case Op::add_const:
+                g[a] += g[out];
+                break;
+            case Op::sub:
+                g[a] += g[out];
+                g[b] -= g[out];
+                break;
+            case Op::rsub_const:
+            case Op::neg:
+                g[a] -= g[out];
+                break;
+            case Op::mul:
+                g[a] += d[b] * g[out];
+                g[b] += d[a] * g[out];
+                break;
+            case Op::mul_const:
+                g[a] += saved * g[out];
+                break;
+            case Op::div:
+                g[a] += g[out] / d[b];
+                g[b] -= d[out] / d[b] * g[out];
+                break;
+            case Op::rdiv_const:
+                g[a] -= d[out] / d[a] * g[out];
+                break;
+            case Op::pow:
+                g[a] += (d[b] * std::pow(d[a], d[b] - 1)) * g[out];
+                g[b] += (d[out] * std::log(d[a])) * g[out];
+                break;
+            case Op::pow_const:
+                g[a] += (saved * std::pow(d[a], saved - 1)) * g[out];
+                break;
+            case Op::exp:
+                g[a] += d[out] * g[out];
+                break;
+            case Op::tanh:
+                g[a] += (1 - d[out] * d[out]) * g[out];
+                break;
+            case Op::relu:
+                g[a] += (d[out] > 0 ? 1.0 : 0.0) * g[out];
+                break;
+            case Op::dot: {
+                const auto* ws = args + a;
+                const auto* xs = ws + b / 2;
+                for (std::uint32_t i = 0; i < b / 2; ++i) {
+                    g[ws[i]] += d[xs[i]] * g[out];
+                    g[xs[i]] += d[ws[i]] * g[out];
+                }
+                break;
+            }
+            case Op::sum:
+                for (std::uint32_t i = 0; i < b; ++i) g[args[a + i]] += g[out];
+                break;
+            }
+        }
+    }
+
+    for (std::size_t i = 0; i < params_.size(); ++i) {
+        params_[i]->grad += g[param_slots_[i]];
+    }
+}
+
+
+} // namespace micrograd